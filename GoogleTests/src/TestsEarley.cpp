@@ -1,6 +1,15 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <optional>
 #include <random>
+#include <set>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 #include "BasicEarleyParser.h"
 
@@ -26,6 +35,99 @@ class EarleyBBS2 : public ::testing::Test, public EarleyBBSConsts {
   EarleyBBS2() : parser_("../TestCases/BBS2") {}
 };
 
+namespace {
+
+// terminals of the test grammars
+const std::map<std::string, std::wstring> kAlphabets = {
+    {"FinitGrammar2", L"abc"},     {"Palindromes", L"ab"},
+    {"NotPalindromes", L"ab"},     {"BBS1", L"()"},
+    {"BBS2", L"()[]{}"},           {"Ambiguous1", L"ab"},
+    {"Ambiguous2", L"abc"},        {"LongEmptySymbol", L"ab"},
+    {"LongNonterminals1", L"abc"}, {"EscapeSymbols", L"A`|\\ "},
+    {"Expressions", L"abcd+*()"}};
+
+// word shorter than `max_size` over the alphabet
+std::wstring RandomWord(std::mt19937_64& gen, const std::wstring& alphabet,
+                        size_t max_size) {
+  std::wstring word(gen() % max_size, L' ');
+  for (auto& symbol : word) {
+    symbol = alphabet[gen() % alphabet.size()];
+  }
+  return word;
+}
+
+// words shorter than `max_size` over the terminals of the grammar, the seed
+// is fixed, so a failure is reproduced
+std::vector<std::wstring> RandomWords(const std::string& grammar, size_t count,
+                                      size_t max_size) {
+  std::mt19937_64 gen(count * max_size);
+  std::vector<std::wstring> words(count);
+  for (auto& word : words) {
+    word = RandomWord(gen, kAlphabets.at(grammar), max_size);
+  }
+  return words;
+}
+
+// unclosed brackets of the word, std::nullopt if some closing bracket doesn't
+// match or a symbol is not a bracket; `brackets` lists the opening and the
+// closing bracket of each pair
+std::optional<size_t> OpenBrackets(std::wstring_view word,
+                                   std::wstring_view brackets = L"()[]{}") {
+  std::vector<size_t> stack;
+  for (wchar_t symbol : word) {
+    size_t ind = brackets.find(symbol);
+    if (ind == std::wstring_view::npos) {
+      return std::nullopt;
+    }
+    if (ind % 2 == 0) {
+      stack.push_back(ind);
+    } else if (stack.empty() || stack.back() + 1 != ind) {
+      return std::nullopt;
+    } else {
+      stack.pop_back();
+    }
+  }
+  return stack.size();
+}
+
+bool Balanced(std::wstring_view word, std::wstring_view brackets = L"()[]{}") {
+  return OpenBrackets(word, brackets) == 0;
+}
+
+// balanced word of `pairs` pairs of brackets
+std::wstring RandomBalanced(std::mt19937_64& gen, size_t pairs,
+                            std::wstring_view brackets = L"()[]{}") {
+  std::wstring word;
+  std::vector<wchar_t> closing;
+  while (pairs > 0 || !closing.empty()) {
+    if (pairs > 0 && (closing.empty() || gen() % 2 == 0)) {
+      size_t pair = gen() % (brackets.size() / 2);
+      word += brackets[2 * pair];
+      closing.push_back(brackets[2 * pair + 1]);
+      --pairs;
+    } else {
+      word += closing.back();
+      closing.pop_back();
+    }
+  }
+  return word;
+}
+
+// balanced words of BBS2 with less than `max_pairs` pairs interleaved with
+// random words of the same length, the seed is fixed
+std::vector<std::wstring> BracketWords(size_t count, size_t max_pairs) {
+  std::mt19937_64 gen(count * max_pairs);
+  std::vector<std::wstring> words(count);
+  for (size_t ind = 0; ind < count; ++ind) {
+    words[ind] = (ind % 2 == 0)
+                     ? RandomBalanced(gen, gen() % max_pairs)
+                     : RandomWord(gen, L"()[]{}", 2 * max_pairs);
+  }
+  return words;
+}
+
+}  // namespace
+
 TEST(EarleyFinitGrammar, FinitGrammar1) {
   WEarleyParser parser("../TestCases/FinitGrammar1");
   EXPECT_EQ(parser.Parse(L""), true);
@@ -197,6 +299,17 @@ TEST_F(EarleyBBS1, BBS1Stress) {
   }
 }
 
+TEST_F(EarleyBBS1, BBS1RightRecursionStress) {
+  // each `)` completes `S -> (S)S` for all previous pairs at once
+  std::wstring sequence;
+  for (size_t i = 0; i < kStressUpperBound / 2; ++i) {
+    sequence += L"()";
+  }
+  EXPECT_EQ(parser_.Parse(sequence), true);
+  EXPECT_EQ(parser_.Parse(sequence + L"(()"), false);
+  EXPECT_EQ(parser_.Parse(L"(" + sequence + L")"), true);
+}
+
 // todo: make random and stress version
 TEST_F(EarleyBBS2, BBS2) {
   EXPECT_EQ(parser_.Parse(L"[]"), true);
@@ -289,4 +402,829 @@ TEST(EarleyLongSymbols, LongNonterminals2) {
   EXPECT_EQ(parser.Parse(L"Dan is impartial teacher."), false);
   EXPECT_EQ(parser.Parse(L"Jack is a brilliant programmer"), false);
   EXPECT_EQ(parser.Parse(L"thomas is a carefree designer."), false);
-}
\ No newline at end of file
+}
+TEST(EarleyLR0Automaton, LongNonterminals2) {
+  WEarleyParser parser("../TestCases/LongNonterminals2");
+  parser.SetMode(WEarleyParser::Mode::LR0Automaton);
+  EXPECT_EQ(parser.Parse(L"Max is an immaculate student."), true);
+  EXPECT_EQ(parser.Parse(L"Jack is a brilliant programmer."), true);
+  EXPECT_EQ(parser.Parse(L"Max is a immaculate student."), false);
+  EXPECT_EQ(parser.Parse(L"Jack is a brilliant programmer"), false);
+}
+
+TEST_F(EarleyBBS1, LR0AutomatonStress) {
+  parser_.SetMode(WEarleyParser::Mode::LR0Automaton);
+  std::wstring sequence = std::wstring(kStressUpperBound / 2, L'(') +
+                         std::wstring(kStressUpperBound / 2, L')');
+  EXPECT_EQ(parser_.Parse(sequence), true);
+  EXPECT_EQ(parser_.Parse(sequence + L")"), false);
+}
+
+TEST(EarleyLR0Automaton, EmptyRules) {
+  // nullable symbols are folded into the states, S -> A S B is entered and
+  // left over A and B
+  WEarleyParser parser("../TestCases/LongEmptySymbol");
+  parser.SetMode(WEarleyParser::Mode::LR0Automaton);
+  for (const wchar_t* word : {L"", L"a", L"b", L"aab", L"abbb"}) {
+    EXPECT_EQ(parser.Parse(word), true) << word;
+  }
+  EXPECT_EQ(parser.Parse(L"ba"), false);
+  EXPECT_EQ(parser.Parse(L"aba"), false);
+}
+
+TEST_F(EarleyBBS2, LR0AutomatonRandom) {
+  WEarleyParser::Statistics dotted_stats;
+  WEarleyParser::Statistics automaton_stats;
+  for (const auto& word : BracketWords(300, 8)) {
+    parser_.SetMode(WEarleyParser::Mode::DottedRules);
+    parser_.Parse(word, dotted_stats);
+    parser_.SetMode(WEarleyParser::Mode::LR0Automaton);
+    EXPECT_EQ(parser_.Parse(word, automaton_stats), Balanced(word)) << word;
+    // a state stands for all of the dotted rules of its closure, the empty
+    // word has no sets to count
+    if (!word.empty()) {
+      EXPECT_LT(automaton_stats.items, dotted_stats.items) << word;
+    }
+  }
+}
+
+TEST(EarleyLookahead, LongNonterminals2) {
+  WEarleyParser parser("../TestCases/LongNonterminals2");
+  WEarleyParser::Statistics stats_off;
+  WEarleyParser::Statistics stats_on;
+  EXPECT_EQ(parser.Parse(L"Max is an immaculate student.", stats_off), true);
+  parser.SetLookahead(true);
+  EXPECT_EQ(parser.Parse(L"Max is an immaculate student.", stats_on), true);
+  EXPECT_LT(stats_on.items, stats_off.items);
+  EXPECT_EQ(parser.Parse(L"Dan is impartial teacher."), false);
+  EXPECT_EQ(parser.Parse(L"Jack is a brilliant programmer"), false);
+}
+
+TEST(EarleyLookahead, NullableSymbols) {
+  // the next symbol may be read after any number of nullable symbols, and
+  // the end of the word is a lookahead too
+  WEarleyParser parser("../TestCases/LongEmptySymbol");
+  parser.SetLookahead(true);
+  EXPECT_EQ(parser.Parse(L""), true);
+  EXPECT_EQ(parser.Parse(L"b"), true);
+  EXPECT_EQ(parser.Parse(L"aaa"), true);
+  EXPECT_EQ(parser.Parse(L"bab"), false);
+}
+
+TEST_F(EarleyBBS2, LookaheadRandom) {
+  WEarleyParser::Statistics stats_off;
+  WEarleyParser::Statistics stats_on;
+  for (const auto& word : BracketWords(300, 8)) {
+    parser_.SetLookahead(false);
+    parser_.Parse(word, stats_off);
+    parser_.SetLookahead(true);
+    EXPECT_EQ(parser_.Parse(word, stats_on), Balanced(word)) << word;
+    // only one of the three kinds of brackets is predicted before a symbol
+    if (!word.empty()) {
+      EXPECT_LT(stats_on.items, stats_off.items) << word;
+    }
+  }
+}
+
+TEST(EarleyBitParallel, SeveralWords) {
+  // dotted rules of the grammar take more than one 64-bit word of the row
+  WEarleyParser bit_parser("../TestCases/LongNonterminals2");
+  WEarleyParser item_parser("../TestCases/LongNonterminals2");
+  item_parser.SetBitParallel(false);
+  for (const wchar_t* word :
+       {L"Max is an immaculate student.", L"Dan is a carefree teacher.",
+        L"Dan is an carefree teacher.", L"Harry is a student."}) {
+    WEarleyParser::Statistics bit_stats;
+    WEarleyParser::Statistics item_stats;
+    EXPECT_EQ(bit_parser.Parse(word, bit_stats),
+              item_parser.Parse(word, item_stats))
+        << word;
+    EXPECT_EQ(bit_stats.items, item_stats.items) << word;
+  }
+}
+
+TEST_F(EarleyBBS2, BitParallelRandom) {
+  WEarleyParser::Statistics bit_stats;
+  WEarleyParser::Statistics item_stats;
+  for (const auto& word : BracketWords(300, 8)) {
+    parser_.SetBitParallel(true);
+    EXPECT_EQ(parser_.Parse(word, bit_stats), Balanced(word)) << word;
+    parser_.SetBitParallel(false);
+    parser_.Parse(word, item_stats);
+    // rows of bits keep the same items
+    EXPECT_EQ(bit_stats.items, item_stats.items) << word;
+  }
+}
+
+TEST(EarleyMemory, ShallowNesting) {
+  std::wstring sequence;
+  for (size_t i = 0; i < 200000; ++i) {
+    sequence += L"(())()";
+  }
+  for (bool bit_parallel : {true, false}) {
+    WEarleyParser parser("../TestCases/BBSLeftRecursion");
+    parser.SetBitParallel(bit_parallel);
+    WEarleyParser::Statistics stats;
+    EXPECT_EQ(parser.Parse(sequence, stats), true);
+    EXPECT_LT(stats.peak_sets, 10);
+    EXPECT_LT(stats.peak_items, 100);
+    EXPECT_EQ(parser.Parse(sequence + L")"), false);
+  }
+  WEarleyParser parser("../TestCases/BBSLeftRecursion");
+  parser.SetMode(WEarleyParser::Mode::LR0Automaton);
+  WEarleyParser::Statistics stats;
+  EXPECT_EQ(parser.Parse(sequence, stats), true);
+  EXPECT_LT(stats.peak_sets, 10);
+}
+
+TEST(EarleyMemory, DeepNesting) {
+  WEarleyParser parser("../TestCases/BBSLeftRecursion");
+  std::wstring sequence = std::wstring(1000, L'(') + std::wstring(1000, L')');
+  WEarleyParser::Statistics stats;
+  EXPECT_EQ(parser.Parse(sequence, stats), true);
+  EXPECT_GE(stats.peak_sets, 1000);
+  EXPECT_LT(stats.peak_sets, 1010);
+}
+
+namespace {
+
+// number of derivation trees of the forest node
+size_t CountTrees(const WEarleyParser::Forest& forest, uint32_t node,
+                  std::vector<size_t>& memo) {
+  if (memo[node] != SIZE_MAX) {
+    return memo[node];
+  }
+  auto children = forest.Children(node);
+  size_t count = children.empty() ? 1 : 0;
+  for (const auto& packed : children) {
+    size_t left = (packed.left == WEarleyParser::Forest::kNoNode)
+                      ? 1
+                      : CountTrees(forest, packed.left, memo);
+    count += left * CountTrees(forest, packed.right, memo);
+  }
+  return memo[node] = count;
+}
+
+size_t CountTrees(const WEarleyParser::Forest& forest) {
+  std::vector<size_t> memo(forest.NodesCount(), SIZE_MAX);
+  return CountTrees(forest, forest.Root(), memo);
+}
+
+}  // namespace
+
+TEST(EarleyForest, Ambiguous2) {
+  WEarleyParser parser("../TestCases/Ambiguous2");
+  WEarleyParser::Forest forest;
+  EXPECT_EQ(parser.Parse(L"aacbb", forest), true);
+  EXPECT_EQ(CountTrees(forest), 1);
+  EXPECT_EQ(parser.Parse(L"aacbbaacbbaacbbaacbb", forest), true);
+  EXPECT_EQ(CountTrees(forest), 5);  // Catalan number
+  const auto& root = forest.GetNode(forest.Root());
+  EXPECT_EQ(forest.SymbolStr(root.symbol), L"S");
+  EXPECT_EQ(root.start, 0);
+  EXPECT_EQ(root.end, 20);
+  EXPECT_EQ(parser.Parse(L"aacbbaacb", forest), false);
+  EXPECT_EQ(forest.Root(), WEarleyParser::Forest::kNoNode);
+}
+
+TEST(EarleyForest, EmptySymbols) {
+  WEarleyParser parser("../TestCases/BBS1");
+  WEarleyParser::Forest forest;
+  EXPECT_EQ(parser.Parse(L"", forest), true);
+  EXPECT_EQ(forest.Children(forest.Root()).size(), 0);
+  EXPECT_EQ(parser.Parse(L"(()())", forest), true);
+  EXPECT_EQ(CountTrees(forest), 1);
+  EXPECT_EQ(parser.Parse(L"(()", forest), false);
+}
+
+TEST(EarleyForest, Blocks) {
+  // blocks `acb` are S, and each span of k > 1 of them is split by S -> S S
+  // in k - 1 ways
+  WEarleyParser parser("../TestCases/Ambiguous2");
+  std::vector<size_t> catalan = {1};
+  std::wstring word;
+  for (size_t blocks = 1; blocks <= 8; ++blocks) {
+    word += L"acb";
+    WEarleyParser::Forest forest;
+    EXPECT_EQ(parser.Parse(word, forest), true);
+    EXPECT_EQ(CountTrees(forest), catalan.back()) << blocks;
+    size_t s_nodes = 0;
+    for (uint32_t node = 0; node < forest.NodesCount(); ++node) {
+      const auto& info = forest.GetNode(node);
+      if (info.intermediate || forest.SymbolStr(info.symbol) != L"S") {
+        continue;
+      }
+      ++s_nodes;
+      size_t span_blocks = (info.end - info.start) / 3;
+      EXPECT_EQ(forest.Children(node).size(),
+                span_blocks == 1 ? 1 : span_blocks - 1)
+          << info.start << ' ' << info.end;
+    }
+    EXPECT_EQ(s_nodes, blocks * (blocks + 1) / 2);
+    size_t next = 0;
+    for (size_t ind = 0; ind < catalan.size(); ++ind) {
+      next += catalan[ind] * catalan[catalan.size() - 1 - ind];
+    }
+    catalan.push_back(next);
+  }
+}
+
+TEST_F(EarleyBBS2, ForestRandom) {
+  // the grammar is unambiguous
+  WEarleyParser::Forest forest;
+  for (const auto& word : BracketWords(300, 8)) {
+    EXPECT_EQ(parser_.Parse(word, forest), Balanced(word)) << word;
+    if (Balanced(word)) {
+      EXPECT_EQ(CountTrees(forest), 1) << word;
+      EXPECT_EQ(forest.GetNode(forest.Root()).end, word.size()) << word;
+    }
+  }
+}
+
+namespace {
+
+// word derived by the tree node
+std::wstring Yield(const WEarleyParser::Tree& tree, uint32_t node) {
+  auto children = tree.Children(node);
+  if (children.empty()) {
+    const auto& leaf = tree.GetNode(node);
+    return (leaf.start == leaf.end) ? L"" : tree.SymbolStr(leaf.symbol);
+  }
+  std::wstring res;
+  for (uint32_t child : children) {
+    EXPECT_EQ(tree.GetNode(child).start, tree.GetNode(node).start + res.size());
+    res += Yield(tree, child);
+  }
+  EXPECT_EQ(tree.GetNode(node).end, tree.GetNode(node).start + res.size());
+  return res;
+}
+
+// the subtree as `symbol[start,end](children)`, terminals as they are
+std::wstring Show(const WEarleyParser::Tree& tree, uint32_t node) {
+  const auto& info = tree.GetNode(node);
+  auto children = tree.Children(node);
+  if (children.empty() && info.start < info.end) {
+    return tree.SymbolStr(info.symbol);
+  }
+  std::wstringstream out;
+  out << tree.SymbolStr(info.symbol) << L'[' << info.start << L','
+      << info.end << L']';
+  if (!children.empty()) {
+    out << L'(';
+    for (size_t ind = 0; ind < children.size(); ++ind) {
+      out << (ind == 0 ? L"" : L" ") << Show(tree, children[ind]);
+    }
+    out << L')';
+  }
+  return out.str();
+}
+
+}  // namespace
+
+TEST(EarleyTree, Ambiguous2) {
+  WEarleyParser parser("../TestCases/Ambiguous2");
+  WEarleyParser::Tree tree;
+  EXPECT_EQ(parser.Parse(L"aacbbaacbbaacbb", tree), true);
+  EXPECT_EQ(Yield(tree, tree.Root()), L"aacbbaacbbaacbb");
+  const auto& root = tree.GetNode(tree.Root());
+  EXPECT_EQ(tree.SymbolStr(root.symbol), L"S");
+  EXPECT_EQ(root.start, 0);
+  EXPECT_EQ(root.end, 15);
+  EXPECT_EQ(tree.Children(tree.Root()).size(), 2);
+  EXPECT_EQ(parser.Parse(L"aacbbaacb", tree), false);
+  EXPECT_EQ(tree.Root(), WEarleyParser::Tree::kNoNode);
+}
+
+TEST(EarleyTree, Spans) {
+  WEarleyParser parser("../TestCases/Expressions");
+  WEarleyParser::Tree tree;
+  EXPECT_EQ(parser.Parse(L"a+b*(c)", tree), true);
+  EXPECT_EQ(Show(tree, tree.Root()),
+            L"S[0,7](S[0,1](T[0,1](F[0,1](V[0,1](a)))) + "
+            L"T[2,7](T[2,3](F[2,3](V[2,3](b))) * "
+            L"F[4,7](( S[5,6](T[5,6](F[5,6](V[5,6](c)))) ))))");
+  // nullable symbols spanning nothing have no children
+  WEarleyParser brackets("../TestCases/BBS1");
+  EXPECT_EQ(brackets.Parse(L"()", tree), true);
+  EXPECT_EQ(Show(tree, tree.Root()), L"S[0,2](( S[1,1] ) S[2,2])");
+}
+
+TEST_F(EarleyBBS2, TreeRandom) {
+  WEarleyParser::Tree tree;
+  for (const auto& word : BracketWords(300, 8)) {
+    EXPECT_EQ(parser_.Parse(word, tree), Balanced(word)) << word;
+    if (Balanced(word)) {
+      EXPECT_EQ(Yield(tree, tree.Root()), word);
+    }
+  }
+}
+
+TEST(EarleyTree, Stress) {
+  // no Leo items here, so right recursion would be quadratic
+  WEarleyParser parser("../TestCases/BBSLeftRecursion");
+  std::wstring sequence;
+  for (size_t i = 0; i < 25000; ++i) {
+    sequence += L"(())";
+  }
+  WEarleyParser::Tree tree;
+  EXPECT_EQ(parser.Parse(sequence, tree), true);
+  // S -> S ( S ) gives 4 nodes per pair of brackets and one more for e
+  EXPECT_EQ(tree.NodesCount(), sequence.size() / 2 * 4 + 1);
+}
+
+TEST(EarleyTerminalClasses, PrintAsRead) {
+  // a, b, c and d make one class
+  WEarleyParser parser("../TestCases/Expressions");
+  std::wstringstream out;
+  parser.PrintGrammar(out);
+  EXPECT_EQ(out.str(),
+            L"S`e\nT`F`V\na`b`c`d`+`*`(`)\n"
+            L"S -> S`+`T | T\nT -> T`*`F | F\nF -> (`S`) | V\n"
+            L"V -> a | b | c | d\n");
+  EXPECT_TRUE(parser.Parse(L"a+b*(c+d)"));
+  EXPECT_FALSE(parser.Parse(L"a+b*(cd)"));
+  EXPECT_FALSE(parser.Parse(L"a+e"));
+}
+
+TEST(EarleyDocument, LocalEdits) {
+  // with left recursion the items of the top level keep origin 0, so the sets
+  // after an edit converge to the old ones as soon as the rest of the word
+  // is at the same nesting
+  WEarleyParser parser("../TestCases/BBSLeftRecursion");
+  std::wstring sequence;
+  for (size_t i = 0; i < 20000; ++i) {
+    sequence += L"()";
+  }
+  WEarleyParser::Document document(parser, sequence);
+  EXPECT_EQ(document.Accepted(), true);
+  EXPECT_EQ(document.Edit(20000, 2, L"(())"), true);
+  EXPECT_LT(document.RebuiltSets(), 10);
+  EXPECT_EQ(document.Edit(100, 1, L""), false);
+  EXPECT_EQ(document.Edit(100, 0, L"("), true);
+  EXPECT_EQ(document.Edit(document.Word().size(), 0, L"()"), true);
+  EXPECT_EQ(document.RebuiltSets(), 2);
+  EXPECT_EQ(document.Edit(30000, 2, L""), true);
+  EXPECT_LT(document.RebuiltSets(), 10);
+  EXPECT_EQ(document.Word().size(), sequence.size() + 2);
+}
+
+TEST(EarleyDocument, EditsAtEnds) {
+  WEarleyParser parser("../TestCases/BBS1");
+  WEarleyParser::Document document(parser);
+  EXPECT_EQ(document.Accepted(), true);
+  EXPECT_EQ(document.Edit(0, 0, L"(("), false);
+  EXPECT_EQ(document.Edit(2, 0, L"))"), true);
+  EXPECT_EQ(document.Edit(0, 1, L""), false);
+  EXPECT_EQ(document.Edit(0, 3, L""), true);
+  EXPECT_EQ(document.Word(), L"");
+}
+
+TEST_F(EarleyBBS2, DocumentRandomEdits) {
+  std::mt19937_64 gen(11);
+  for (const auto& word : BracketWords(50, 8)) {
+    WEarleyParser::Document document(parser_, word);
+    EXPECT_EQ(document.Accepted(), Balanced(word));
+    for (size_t edit = 0; edit < 10; ++edit) {
+      size_t offset = gen() % (document.Word().size() + 1);
+      size_t deleted = gen() % 3;
+      std::wstring inserted = (edit % 2 == 0)
+                                  ? RandomBalanced(gen, gen() % 3)
+                                  : RandomWord(gen, L"()[]{}", 3);
+      bool was_accepted = document.Accepted();
+      bool accepted = document.Edit(offset, deleted, inserted);
+      const std::wstring& edited = document.Word();
+      EXPECT_EQ(accepted, Balanced(edited)) << edited;
+      // the reparsed chart accepts as a fresh one does
+      EXPECT_EQ(accepted, WEarleyParser::Document(parser_, edited).Accepted())
+          << edited;
+      // sets before the offset are kept if the chart has reached it
+      if (was_accepted) {
+        EXPECT_LE(document.RebuiltSets(), edited.size() - offset + 1)
+            << edited;
+      }
+    }
+  }
+}
+
+TEST_F(EarleyBBS2, RecognizerChunks) {
+  // chunks of up to 3 symbols, empty ones too
+  std::mt19937_64 gen(12);
+  for (const auto& word : BracketWords(300, 8)) {
+    WEarleyParser::Recognizer recognizer(parser_);
+    std::wstring_view rest = word;
+    std::wstring fed;
+    while (!rest.empty()) {
+      size_t size = std::min<size_t>(gen() % 4, rest.size());
+      fed = word.substr(0, fed.size() + size);
+      bool viable = OpenBrackets(fed).has_value();
+      EXPECT_EQ(recognizer.Feed(rest.substr(0, size)), viable) << fed;
+      EXPECT_EQ(recognizer.IsViablePrefix(), viable) << fed;
+      EXPECT_EQ(recognizer.Finish(), Balanced(fed)) << fed;
+      rest.remove_prefix(size);
+    }
+    EXPECT_EQ(recognizer.Finish(), Balanced(word)) << word;
+  }
+}
+
+TEST(EarleyRecognizer, ViablePrefix) {
+  WEarleyParser parser("../TestCases/BBS2");
+  WEarleyParser::Recognizer recognizer(parser);
+  EXPECT_EQ(recognizer.Finish(), true);
+  std::wstring chunk = L"([{}])";
+  for (size_t i = 0; i < 1000; ++i) {
+    EXPECT_EQ(recognizer.Feed(chunk), true);
+  }
+  EXPECT_EQ(recognizer.Feed(std::wstring_view(L"((")), true);
+  EXPECT_EQ(recognizer.Finish(), false);
+  EXPECT_EQ(recognizer.Feed(std::wstring_view(L"]")), false);
+  EXPECT_EQ(recognizer.IsViablePrefix(), false);
+  EXPECT_EQ(recognizer.Feed(std::wstring_view(L"))")), false);
+  EXPECT_EQ(recognizer.Finish(), false);
+}
+
+TEST(EarleyParallel, SameAsSequential) {
+  WEarleyParser parser("../TestCases/Ambiguous2");
+  parser.SetBitParallel(false);
+  // sets get more than a thousand items at the end
+  std::wstring word;
+  for (size_t i = 0; i < 700; ++i) {
+    word += L"aacbb";
+  }
+  WEarleyParser::Statistics sequential;
+  WEarleyParser::Statistics parallel;
+  EXPECT_EQ(parser.Parse(word, sequential), true);
+  parser.SetThreads(4);
+  EXPECT_EQ(parser.Parse(word, parallel), true);
+  EXPECT_EQ(parallel.items, sequential.items);
+  word.back() = L'a';
+  EXPECT_EQ(parser.Parse(word, parallel), false);
+}
+
+TEST(EarleyParallel, PoolStealsWork) {
+  // indices of the part of the calling thread are slow, so the other threads
+  // steal them when they are done with their parts
+  utl::ThreadPool pool(4);
+  std::vector<std::atomic<size_t>> visits(10000);
+  std::vector<std::atomic<size_t>> by_worker(pool.Size());
+  for (size_t round = 0; round < 3; ++round) {
+    pool.ParallelFor(
+        visits.size(), 16, [&](size_t begin, size_t end, size_t worker) {
+          for (size_t ind = begin; ind < end; ++ind) {
+            if (ind < visits.size() / pool.Size()) {
+              std::this_thread::sleep_for(std::chrono::microseconds(20));
+            }
+            ++visits[ind];
+          }
+          by_worker[worker] += end - begin;
+        });
+  }
+  for (size_t ind = 0; ind < visits.size(); ++ind) {
+    EXPECT_EQ(visits[ind], 3) << ind;
+  }
+  EXPECT_LT(by_worker[0], 3 * visits.size() / pool.Size());
+}
+
+TEST(EarleyBatch, SharedPrefixes) {
+  // repeated words and words that are prefixes of others, in any order
+  WEarleyParser parser("../TestCases/BBS1");
+  std::vector<std::wstring> words = {L"(())", L"(", L"", L"()", L"(()",
+                                     L"()",   L")", L"(()())"};
+  EXPECT_EQ(parser.ParseAll(words),
+            std::vector<bool>({true, false, true, true, false, true, false,
+                               true}));
+  EXPECT_EQ(parser.ParseAll({}), std::vector<bool>());
+}
+
+TEST_F(EarleyBBS2, BatchRandom) {
+  // words are followed by their prefixes, so paths of the trie are shared
+  std::vector<std::wstring> words;
+  for (const auto& word : BracketWords(200, 6)) {
+    words.push_back(word);
+    words.push_back(word.substr(0, word.size() / 2));
+  }
+  std::vector<bool> res = parser_.ParseAll(words);
+  ASSERT_EQ(res.size(), words.size());
+  for (size_t ind = 0; ind < words.size(); ++ind) {
+    EXPECT_EQ(res[ind], Balanced(words[ind])) << words[ind];
+  }
+}
+
+TEST(EarleySpans, Brackets) {
+  WEarleyParser parser("../TestCases/BBS1");
+  std::vector<std::pair<size_t, size_t>> spans;
+  parser.FindAll(L"(()x())", [&spans](size_t start, size_t end) {
+    spans.emplace_back(start, end);
+  });
+  std::vector<std::pair<size_t, size_t>> expected = {{1, 3}, {4, 6}};
+  EXPECT_EQ(spans, expected);
+  spans.clear();
+  parser.FindAll(
+      L"()()(", [&spans](size_t start, size_t end) {
+        spans.emplace_back(start, end);
+      },
+      true);
+  expected = {{0, 2}, {0, 4}};
+  EXPECT_EQ(spans, expected);
+  // the longest spans of different ends overlap
+  spans.clear();
+  parser.FindAll(
+      L"(()())", [&spans](size_t start, size_t end) {
+        spans.emplace_back(start, end);
+      },
+      true);
+  expected = {{1, 3}, {1, 5}, {0, 6}};
+  EXPECT_EQ(spans, expected);
+}
+
+TEST_F(EarleyBBS2, SpansRandom) {
+  for (const auto& text : RandomWords("BBS2", 50, 20)) {
+    auto index = parser_.FindAll(text);
+    size_t count = 0;
+    // the longest span of each end has the least start
+    std::vector<std::pair<size_t, size_t>> longest;
+    std::vector<std::pair<size_t, size_t>> expected_longest;
+    parser_.FindAll(
+        text,
+        [&longest](size_t start, size_t end) {
+          longest.emplace_back(start, end);
+        },
+        true);
+    for (size_t end = 1; end <= text.size(); ++end) {
+      bool found = false;
+      for (size_t start = 0; start < end; ++start) {
+        bool balanced =
+            Balanced(std::wstring_view(text).substr(start, end - start));
+        count += balanced;
+        EXPECT_EQ(index.Contains(start, end), balanced)
+            << text << ' ' << start << ' ' << end;
+        if (balanced && !found) {
+          expected_longest.emplace_back(start, end);
+          found = true;
+        }
+      }
+    }
+    EXPECT_EQ(index.Size(), count) << text;
+    EXPECT_EQ(longest, expected_longest) << text;
+  }
+}
+
+namespace {
+
+// words of all paths from `pos` to `end`
+void LatticeWords(const std::vector<WEarleyParser::Edge>& lattice, size_t pos,
+                  size_t end, std::wstring& word,
+                  std::vector<std::wstring>& words) {
+  if (pos == end) {
+    words.push_back(word);
+    return;
+  }
+  for (const auto& edge : lattice) {
+    if (edge.from == pos && edge.to <= end) {
+      word.push_back(edge.symbol);
+      LatticeWords(lattice, edge.to, end, word, words);
+      word.pop_back();
+    }
+  }
+}
+
+}  // namespace
+
+TEST(EarleyLattice, Segmentations) {
+  WEarleyParser parser("../TestCases/Palindromes");
+  // a (a | b) (b | a a) a
+  std::vector<WEarleyParser::Edge> lattice = {
+      {0, 1, L'a'}, {1, 2, L'a'}, {1, 2, L'b'}, {2, 3, L'b'},
+      {2, 4, L'a'}, {3, 4, L'a'}, {4, 5, L'a'}};
+  EXPECT_EQ(parser.Parse(lattice, 5), true);
+  lattice[1].symbol = L'b';
+  EXPECT_EQ(parser.Parse(lattice, 5), false);
+  EXPECT_EQ(parser.Parse(lattice, 4), true);
+}
+
+TEST_F(EarleyBBS2, LatticeRandom) {
+  // path of the word and up to 2 more edges of 1 or 2 positions from each
+  // position, so some paths are balanced even if the word is not
+  std::mt19937_64 gen(16);
+  const std::wstring alphabet = L"()[]{}";
+  for (const auto& word : BracketWords(200, 4)) {
+    std::vector<WEarleyParser::Edge> lattice;
+    for (size_t from = 0; from < word.size(); ++from) {
+      lattice.push_back({from, from + 1, word[from]});
+      for (size_t edge_i = gen() % 3; edge_i > 0; --edge_i) {
+        size_t to = from + 1 + gen() % 2;
+        lattice.push_back({from, to, alphabet[gen() % alphabet.size()]});
+      }
+    }
+    std::wstring path;
+    std::vector<std::wstring> paths;
+    LatticeWords(lattice, 0, word.size(), path, paths);
+    size_t balanced = std::ranges::count_if(
+        paths, [](const auto& path) { return Balanced(path); });
+    EXPECT_EQ(parser_.Parse(lattice, word.size()), balanced > 0)
+        << word << ", paths: " << paths.size();
+  }
+}
+
+TEST(EarleyClassifier, SameAsParsers) {
+  const std::vector<std::string> filenames = {
+      "../TestCases/Palindromes", "../TestCases/NotPalindromes",
+      "../TestCases/BBS1",        "../TestCases/Ambiguous1",
+      "../TestCases/BBS2",        "../TestCases/LongEmptySymbol"};
+  WEarleyParser::Classifier classifier(filenames);
+  std::vector<WEarleyParser> parsers;
+  for (const auto& filename : filenames) {
+    parsers.emplace_back(filename);
+  }
+  std::wstring alphabet = L"ab()[";
+  std::mt19937_64 gen(1000);
+  for (size_t iter_i = 0; iter_i < 1000; ++iter_i) {
+    std::wstring word(gen() % 10, L' ');
+    for (auto& symbol : word) {
+      symbol = alphabet[gen() % (iter_i % 2 == 0 ? 2 : alphabet.size())];
+    }
+    std::vector<size_t> expected;
+    for (size_t ind = 0; ind < parsers.size(); ++ind) {
+      if (parsers[ind].Parse(word)) {
+        expected.push_back(ind);
+      }
+    }
+    EXPECT_EQ(classifier.Parse(word), expected) << "Word: " << word << '\n';
+  }
+}
+
+TEST(EarleyClassifier, SharedNonterminals) {
+  // T of NotPalindromes has the same rules as S of Palindromes
+  WEarleyParser::Classifier classifier(
+      {"../TestCases/Palindromes", "../TestCases/NotPalindromes",
+       "../TestCases/Palindromes"});
+  std::wstringstream out;
+  classifier.PrintGrammar(out);
+  std::wstring line;
+  size_t lines_count = 0;
+  while (std::getline(out, line)) {
+    ++lines_count;
+  }
+  // 3 lines of symbols and rules of START, S and T
+  EXPECT_EQ(lines_count, 6);
+  EXPECT_EQ(classifier.Parse(L"abba"), std::vector<size_t>({0, 2}));
+  EXPECT_EQ(classifier.Parse(L"abaa"), std::vector<size_t>({1}));
+}
+
+TEST(EarleyClassifier, NarrowChars) {
+  EarleyParser::Classifier classifier({"../TestCases/Palindromes",
+                                       "../TestCases/NotPalindromes",
+                                       "../TestCases/BBS1"});
+  std::stringstream out;
+  classifier.PrintGrammar(out);
+  std::string line;
+  std::getline(out, line);
+  EXPECT_EQ(line, "START`EPSILON");
+  std::getline(out, line);
+  EXPECT_NE(line.find("S_0"), std::string::npos) << line;
+  EXPECT_EQ(classifier.Parse("abba"), std::vector<size_t>({0}));
+  EXPECT_EQ(classifier.Parse("abaa"), std::vector<size_t>({1}));
+  EXPECT_EQ(classifier.Parse("(())()"), std::vector<size_t>({2}));
+  EXPECT_EQ(classifier.Parse(""), std::vector<size_t>({0, 2}));
+}
+
+TEST(EarleyBeam, WideBeamSameAsParse) {
+  WEarleyParser parser("../TestCases/Ambiguous2");
+  WEarleyParser beam_parser("../TestCases/Ambiguous2");
+  beam_parser.SetBeam(1000);
+  for (const wchar_t* word :
+       {L"acb", L"aacbbacb", L"aaacbbbacbaacbb", L"acbb", L"aacb", L""}) {
+    WEarleyParser::Statistics stats;
+    EXPECT_EQ(beam_parser.Parse(word, stats), parser.Parse(word)) << word;
+    EXPECT_FALSE(stats.pruned) << word;
+  }
+}
+
+TEST(EarleyBeam, NarrowBeamPrunes) {
+  WEarleyParser parser("../TestCases/Ambiguous2");
+  std::wstring word;
+  for (size_t ind = 0; ind < 20; ++ind) {
+    word += L"aacbb";
+  }
+  WEarleyParser::Statistics full;
+  EXPECT_TRUE(parser.Parse(word, full));
+  EXPECT_FALSE(full.pruned);
+  parser.SetBeam(4);
+  WEarleyParser::Statistics pruned;
+  parser.Parse(word, pruned);
+  EXPECT_TRUE(pruned.pruned);
+  EXPECT_LT(pruned.peak_items, full.peak_items);
+}
+
+TEST(EarleyBeam, RuleWeights) {
+  WEarleyParser parser("../TestCases/Ambiguous2");
+  std::wstring word;
+  for (size_t ind = 0; ind < 20; ++ind) {
+    word += L"acb";
+  }
+  // items of S -> S S are needed but have the least weight
+  parser.LoadRuleWeights("../TestCases/Ambiguous2Weights");
+  parser.SetBeam(2);
+  EXPECT_FALSE(parser.Parse(word));
+  // the opposite order of rules with a score
+  parser.SetBeam(2, [](size_t rule, size_t, size_t) { return rule == 0; });
+  EXPECT_TRUE(parser.Parse(word));
+}
+
+TEST(EarleyBeam, MergedRuleWeights) {
+  // V -> a | b | c | d is one rule over classes with the largest weight 2,
+  // other rules weigh 2 if they are needed for a variable alone
+  WEarleyParser parser("../TestCases/Expressions");
+  parser.LoadRuleWeights("../TestCases/ExpressionsWeights");
+  parser.SetBeam(4);
+  EXPECT_TRUE(parser.Parse(L"b"));
+  EXPECT_FALSE(parser.Parse(L"b+c"));
+}
+
+TEST(EarleyBeam, MergedRuleScores) {
+  // rules V -> a and V -> b are merged, so T -> c is the third rule over
+  // classes and the fourth one in the grammar
+  std::wstringstream grammar(L"S`e\nV`T\na`b`c\nS -> V`T\nV -> a | b\nT -> c");
+  WEarleyParser parser(grammar);
+  std::set<size_t> rules;
+  parser.SetBeam(1, [&rules](size_t rule, size_t, size_t) {
+    rules.insert(rule);
+    return 1;
+  });
+  parser.Parse(L"bc");
+  EXPECT_EQ(rules, std::set<size_t>({0, 1, 3}));
+}
+
+TEST(EarleyBeamDeathTest, WrongWeightsCount) {
+  WEarleyParser parser("../TestCases/Ambiguous1");
+  EXPECT_EXIT(parser.LoadRuleWeights("../TestCases/Ambiguous2Weights"),
+              testing::ExitedWithCode(ExitStatus::IncorrectGrammarInput),
+              "Expected 3 weights of rules");
+  WEarleyParser expressions("../TestCases/Expressions");
+  EXPECT_EXIT(expressions.LoadRuleWeights("../TestCases/Ambiguous2Weights"),
+              testing::ExitedWithCode(ExitStatus::IncorrectGrammarInput),
+              "Expected 10 weights of rules");
+}
+
+TEST(EarleyDistance, Brackets) {
+  WEarleyParser parser("../TestCases/BBS1");
+  EXPECT_EQ(parser.Distance(L"", 0), 0);
+  EXPECT_EQ(parser.Distance(L"(())()", 3), 0);
+  EXPECT_EQ(parser.Distance(L"(()", 3), 1);
+  EXPECT_EQ(parser.Distance(L")(", 3), 2);
+  EXPECT_EQ(parser.Distance(L"((((", 4), 2);
+  EXPECT_EQ(parser.Distance(L"((((", 1), std::nullopt);
+  EXPECT_EQ(parser.Distance(L"(x)", 1), 1);
+}
+
+TEST(EarleyDistance, SameAsEdits) {
+  WEarleyParser parser("../TestCases/Ambiguous2");
+  const std::wstring alphabet = L"abc";
+  for (std::wstring_view view : {L"acb", L"aacbbacb", L"abcab", L"ccc"}) {
+    std::wstring word(view);
+    // distance 1 is checked by applying all of the single edits
+    bool one_edit = false;
+    for (size_t pos = 0; pos <= word.size(); ++pos) {
+      for (wchar_t symbol : alphabet) {
+        std::wstring edited = word;
+        one_edit = one_edit || parser.Parse(edited.insert(pos, 1, symbol));
+        if (pos < word.size()) {
+          edited = word;
+          edited[pos] = symbol;
+          one_edit = one_edit || parser.Parse(edited);
+        }
+      }
+      if (pos < word.size()) {
+        one_edit = one_edit || parser.Parse(std::wstring(word).erase(pos, 1));
+      }
+    }
+    std::optional<size_t> distance = parser.Distance(word, 1);
+    if (parser.Parse(word)) {
+      EXPECT_EQ(distance, 0) << word;
+    } else if (one_edit) {
+      EXPECT_EQ(distance, 1) << word;
+    } else {
+      EXPECT_EQ(distance, std::nullopt) << word;
+    }
+  }
+}
+
+TEST(EarleySpill, SameAsParse) {
+  WEarleyParser parser("../TestCases/BBS1");
+  WEarleyParser spill_parser("../TestCases/BBS1");
+  spill_parser.SetSpill(8);
+  std::wstring word;
+  for (size_t ind = 0; ind < 3000; ++ind) {
+    word += L"(()(";
+  }
+  for (size_t ind = 0; ind < 3000; ++ind) {
+    word += L"))";
+  }
+  for (const std::wstring& tested : {word, word + L")", word.substr(1)}) {
+    WEarleyParser::Statistics stats;
+    WEarleyParser::Statistics spill_stats;
+    EXPECT_EQ(spill_parser.Parse(tested, spill_stats),
+              parser.Parse(tested, stats));
+    EXPECT_GT(spill_stats.spilled, 0);
+    EXPECT_LT(spill_stats.peak_items, stats.peak_items);
+  }
+}
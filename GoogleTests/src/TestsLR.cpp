@@ -1,7 +1,10 @@
 #include <gtest/gtest.h>
 
 #include <random>
+#include <sstream>
+#include <vector>
 
+#include "BasicEarleyParser.h"
 #include "BasicLR1Parser.h"
 
 // todo: add tests for non-LR grammar
@@ -227,4 +230,195 @@ TEST_F(LR1BBS2, BBS2) {
   EXPECT_EQ(parser_.Parse(L"()[][}"), false);
   EXPECT_EQ(parser_.Parse(L"[{()})"), false);
   EXPECT_EQ(parser_.Parse(L"[[][]"), false);
-}
\ No newline at end of file
+}
+namespace {
+using TableKind = WLRParser<1>::TableKind;
+using Construction = WLRParser<1>::Construction;
+
+// parsers with the kind of table and the construction accept the same random
+// words over the alphabet as canonical parsers with dense tables
+void ExpectSameAsCanonical(const std::vector<const char*>& filenames,
+                           TableKind kind, Construction construction,
+                           const std::wstring& alphabet) {
+  std::mt19937 gen(7);
+  for (const char* filename : filenames) {
+    WLRParser<1> canonical(filename);
+    WLRParser<1> parser(filename, kind, construction);
+    for (size_t iter = 0; iter < 2000; ++iter) {
+      std::wstring word(gen() % 9, L' ');
+      for (wchar_t& symbol : word) {
+        symbol = alphabet[gen() % alphabet.size()];
+      }
+      EXPECT_EQ(parser.Parse(word), canonical.Parse(word))
+          << filename << ' ' << word;
+    }
+  }
+}
+}  // namespace
+
+TEST(LR1Dense, SameAsEarley) {
+  // dense tables accept the same short words as the Earley parser does
+  const std::vector<std::pair<const char*, std::wstring>> grammars = {
+      {"../TestCases/BBS1", L"()"},
+      {"../TestCases/BBS2", L"()[]{}"},
+      {"../TestCases/LR1/Test1", L"ab"},
+      {"../TestCases/LR1/Test2", L"abc"},
+      {"../TestCases/LR1/Test3", L"abc"},
+      {"../TestCases/Expressions", L"ab+*()"},
+      {"../TestCases/LR1/NotLALR", L"abcdx"}};
+  for (const auto& [filename, alphabet] : grammars) {
+    WLRParser<1> parser(filename);
+    WEarleyParser earley(filename);
+    // all words up to the longest size having at most 5000 words
+    size_t max_size = 0;
+    for (size_t count = 1; count * alphabet.size() <= 5000; ++max_size) {
+      count *= alphabet.size();
+    }
+    std::vector<size_t> digits;
+    while (digits.size() <= max_size) {
+      std::wstring word;
+      for (size_t digit : digits) {
+        word += alphabet[digit];
+      }
+      EXPECT_EQ(parser.Parse(word), earley.Parse(word))
+          << filename << ' ' << word;
+      size_t pos = 0;
+      while (pos < digits.size() && ++digits[pos] == alphabet.size()) {
+        digits[pos++] = 0;
+      }
+      if (pos == digits.size()) {
+        digits.push_back(0);
+      }
+    }
+  }
+  // 10 canonical states of 5 symbols (`(`, `)`, EPSILON, AUXILIARY and S),
+  // 4 bytes per cell, and 2 rules of 8 bytes
+  WLRParser<1> bbs("../TestCases/BBS1");
+  EXPECT_EQ(bbs.TableSize(), 10 * 5 * 4 + 2 * 8);
+}
+
+TEST(LR1Compressed, SameAsDense) {
+  ExpectSameAsCanonical({"../TestCases/BBS2", "../TestCases/LR1/Test1",
+                         "../TestCases/LR1/Test2", "../TestCases/LR1/Test3"},
+                        TableKind::Compressed, Construction::Canonical,
+                        L"()[]{}abcx");
+}
+
+TEST(LR1Compressed, WideAlphabet) {
+  // lists of words of 2 symbols, 60 words
+  std::wstringstream grammar;
+  grammar << L"S`e\nT\n";
+  std::wstring rule = L"T -> ";
+  for (size_t ind = 0; ind < 60; ++ind) {
+    wchar_t first = wchar_t(0x100 + 2 * ind);
+    wchar_t second = wchar_t(0x100 + 2 * ind + 1);
+    grammar << (ind == 0 ? L"" : L"`") << first << L'`' << second;
+    rule += std::wstring(ind == 0 ? L"" : L" | ") + first + L'`' + second;
+  }
+  grammar << L"\nS -> T`S | e\n" << rule;
+  WLRParser<1> dense(grammar);
+  grammar.clear();
+  grammar.seekg(0);
+  WLRParser<1> compressed(grammar, TableKind::Compressed);
+  EXPECT_LT(compressed.TableSize() * 4, dense.TableSize());
+  std::wstring word = {0x100, 0x101, 0x110, 0x111, 0x100, 0x101};
+  EXPECT_TRUE(compressed.Parse(word));
+  EXPECT_FALSE(compressed.Parse(word.substr(1)));
+  EXPECT_FALSE(compressed.Parse(word + wchar_t(0x100)));
+  EXPECT_FALSE(compressed.Parse(word + wchar_t(0x103)));
+}
+
+TEST(LR1TerminalClasses, SameTableAsOneLetter) {
+  // a, b, c and d of the variables are interchangeable
+  WLRParser<1> parser("../TestCases/Expressions");
+  std::wstringstream one_letter(
+      L"S`e\nT`F`V\na`+`*`(`)\n"
+      L"S -> S`+`T | T\nT -> T`*`F | F\nF -> (`S`) | V\nV -> a");
+  WLRParser<1> one_letter_parser(one_letter);
+  EXPECT_EQ(parser.TableSize(), one_letter_parser.TableSize());
+  EXPECT_TRUE(parser.Parse(L"a+b*(c+d)"));
+  EXPECT_TRUE(parser.Parse(L"(d)"));
+  EXPECT_FALSE(parser.Parse(L"a+b*(cd)"));
+  EXPECT_FALSE(parser.Parse(L"a+e"));
+  EXPECT_FALSE(parser.Parse(L"a+"));
+}
+
+TEST(LR1LALR, SameAsCanonical) {
+  const std::vector<const char*> filenames = {
+      "../TestCases/BBS2",        "../TestCases/LR1/Test1",
+      "../TestCases/LR1/Test2",   "../TestCases/LR1/Test3",
+      "../TestCases/Expressions", "../TestCases/LR1/NotLALR"};
+  ExpectSameAsCanonical(filenames, TableKind::Dense, Construction::LALR,
+                        L"()[]{}abcdx+*");
+  for (const char* filename : filenames) {
+    WLRParser<1> canonical(filename);
+    WLRParser<1> lalr(filename, TableKind::Dense, Construction::LALR);
+    EXPECT_LE(lalr.TableSize(), canonical.TableSize()) << filename;
+  }
+  // lookaheads split the states of expressions inside and outside brackets:
+  // 24 canonical states against 13
+  WLRParser<1> canonical("../TestCases/Expressions");
+  WLRParser<1> lalr("../TestCases/Expressions", TableKind::Dense,
+                    Construction::LALR);
+  EXPECT_LT(lalr.TableSize() * 3, canonical.TableSize() * 2);
+}
+
+TEST(LR1LALR, NotLALR) {
+  // merged lookaheads after `ax` and `bx` make a conflict, so the canonical
+  // states are used
+  WLRParser<1> canonical("../TestCases/LR1/NotLALR");
+  WLRParser<1> lalr("../TestCases/LR1/NotLALR", TableKind::Dense,
+                    Construction::LALR);
+  EXPECT_EQ(lalr.BuiltConstruction(), Construction::Canonical);
+  EXPECT_EQ(lalr.TableSize(), canonical.TableSize());
+  EXPECT_TRUE(lalr.Parse(L"axc"));
+  EXPECT_TRUE(lalr.Parse(L"bxd"));
+  EXPECT_FALSE(lalr.Parse(L"axb"));
+  EXPECT_FALSE(lalr.Parse(L"ax"));
+  WLRParser<1> expressions("../TestCases/Expressions", TableKind::Dense,
+                           Construction::LALR);
+  EXPECT_EQ(expressions.BuiltConstruction(), Construction::LALR);
+}
+
+TEST(LR1LALRDeathTest, NotLR1) {
+  // the canonical states have the conflict too
+  EXPECT_EXIT(WLRParser<1>("../TestCases/Palindromes", TableKind::Dense,
+                           Construction::LALR),
+              testing::ExitedWithCode(2), "grammar is not LR\\(1\\)");
+}
+
+TEST(LR1Pager, SameAsCanonical) {
+  ExpectSameAsCanonical(
+      {"../TestCases/BBS2", "../TestCases/LR1/Test1", "../TestCases/LR1/Test2",
+       "../TestCases/LR1/Test3", "../TestCases/Expressions",
+       "../TestCases/LR1/NotLALR"},
+      TableKind::Compressed, Construction::Pager, L"()[]{}abcdx+*");
+  // the same states as LALR(1) where it has no conflicts
+  WLRParser<1> lalr("../TestCases/Expressions", TableKind::Dense,
+                    Construction::LALR);
+  WLRParser<1> pager("../TestCases/Expressions", TableKind::Dense,
+                     Construction::Pager);
+  EXPECT_EQ(pager.TableSize(), lalr.TableSize());
+  // states after `ax` and `bx` are not merged
+  WLRParser<1> not_lalr("../TestCases/LR1/NotLALR", TableKind::Dense,
+                        Construction::Pager);
+  EXPECT_TRUE(not_lalr.Parse(L"bxc"));
+  EXPECT_TRUE(not_lalr.Parse(L"axd"));
+  EXPECT_FALSE(not_lalr.Parse(L"bx"));
+}
+
+TEST(LR1Pager, NotPager) {
+  // A derives no word, so the items predicted after `aA` have no lookaheads:
+  // canonical states don't have them, while Pager states keep them and shift
+  // `a` where `A -> ASA` is reduced, so the canonical states are used
+  WLRParser<1> canonical("../TestCases/LR1/NotPager");
+  WLRParser<1> pager("../TestCases/LR1/NotPager", TableKind::Dense,
+                     Construction::Pager);
+  EXPECT_EQ(pager.BuiltConstruction(), Construction::Canonical);
+  EXPECT_EQ(pager.TableSize(), canonical.TableSize());
+  EXPECT_TRUE(pager.Parse(L""));
+  EXPECT_FALSE(pager.Parse(L"a"));
+  WLRParser<1> not_lalr("../TestCases/LR1/NotLALR", TableKind::Dense,
+                        Construction::Pager);
+  EXPECT_EQ(not_lalr.BuiltConstruction(), Construction::Pager);
+}
@@ -1,14 +1,57 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <boost/dynamic_bitset.hpp>
+#include <cstdint>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <variant>
 
 #include "GrammarBase.h"
+#include "SpillFile.h"
+#include "ThreadPool.h"
 
 template <typename CharT>
 class BasicEarleyParser {
  public:
+  // chart items are either dotted rules or states of LR(0) automaton
+  enum class Mode { DottedRules, LR0Automaton };
+  struct Statistics {
+    size_t items = 0;       // items in all sets of the chart
+    size_t peak_sets = 0;   // sets kept at once at most
+    size_t peak_items = 0;  // items kept at once at most
+    bool pruned = false;    // some items were dropped by the beam
+    size_t spilled = 0;     // items written to the spill file
+  };
+  // score of an item of the chart for the beam, higher is better; `rule` is
+  // the number of the rule (see LoadRuleWeights()), the first one of merged
+  // alternatives, `dot` is the position of the dot in it and `length` is the
+  // length of the span the item covers
+  using Score = std::function<double(size_t rule, size_t dot, size_t length)>;
+  class Forest;
+  class Tree;
+  class Document;
+  class Recognizer;
+  class SpanIndex;
+  class Classifier;
+  // edge of a lattice of symbols, `from` < `to`
+  struct Edge {
+    size_t from;
+    size_t to;
+    CharT symbol;
+  };
+
   BasicEarleyParser() = default;
   BasicEarleyParser(const std::string& filename);
   BasicEarleyParser(std::basic_istream<CharT>& input);
@@ -17,6 +60,56 @@ class BasicEarleyParser {
   void EnterGrammar(std::basic_istream<CharT>& input);
   void PrintGrammar(std::basic_ostream<CharT>& out);
   bool Parse(const std::basic_string<CharT>& word) const;
+  bool Parse(const std::basic_string<CharT>& word, Statistics& stats) const;
+  // also builds the forest of all derivations of the word
+  bool Parse(const std::basic_string<CharT>& word, Forest& forest) const;
+  // also builds one derivation of the word
+  bool Parse(const std::basic_string<CharT>& word, Tree& tree) const;
+  // recognizes the words walking the trie of them, so sets of a common prefix
+  // are built once (chart of items without lookahead)
+  std::vector<bool> ParseAll(
+      const std::vector<std::basic_string<CharT>>& words) const;
+  // calls `match(start, end)` for nonempty spans of the text derived from the
+  // start symbol as soon as their end is read, in order of ends and then of
+  // starts; only the longest span for each end if `longest` is set, such
+  // spans of different ends may still overlap (chart of items)
+  void FindAll(const std::basic_string<CharT>& text,
+               const std::function<void(size_t, size_t)>& match,
+               bool longest = false) const;
+  // index of all of such spans
+  SpanIndex FindAll(const std::basic_string<CharT>& text) const;
+  // 'true' if some path of edges from position 0 to `end` gives an accepted
+  // word, all of the paths are recognized in one chart (chart of items
+  // without lookahead)
+  bool Parse(std::span<const Edge> lattice, size_t end) const;
+  void SetMode(Mode mode);
+  // predicted items that can't start with the next symbol are not created
+  // (DottedRules mode only)
+  void SetLookahead(bool enabled);
+  // chart of bit rows is used if the grammar is small enough (on by default)
+  void SetBitParallel(bool enabled);
+  // closure of sets with many items is split between `count` threads
+  // (chart of items only, 1 by default)
+  void SetThreads(size_t count);
+  // at most `width` items with the highest score are kept in each set, so
+  // words may be rejected wrongly; 0 is no limit, otherwise the chart of
+  // items is used whatever the mode; the score is the weight of the rule by
+  // default
+  void SetBeam(size_t width, Score score = {});
+  // reads weights of rules: one number per rule, rules are numbered in order
+  // of nonterminals in the grammar file and then in order of alternatives;
+  // alternatives which are the same over classes of interchangeable terminals
+  // are one rule with the largest of their weights
+  void LoadRuleWeights(const std::string& filename);
+  // sets older than the last `resident_sets` are written to a temporary file
+  // and mapped back to memory when they are completed, so long words need
+  // less memory; 0 is off, otherwise the chart of items is used whatever the
+  // mode (Parse() only)
+  void SetSpill(size_t resident_sets);
+  // least number of insertions, deletions and substitutions of symbols that
+  // make the word accepted, std::nullopt if it is more than `max_errors`
+  std::optional<size_t> Distance(const std::basic_string<CharT>& word,
+                                 size_t max_errors) const;
 
  private:
   using String = utl::BasicString<CharT>;
@@ -27,295 +120,3300 @@ class BasicEarleyParser {
   using UMap = std::unordered_map<Key, Value, Hash>;
   template <class Key, class Hash = std::hash<Key>>
   using USet = std::unordered_set<Key, Hash>;
-  template <typename T>
-  using RefW = std::reference_wrapper<T>;
+  using Bitset = boost::dynamic_bitset<>;
 
-  struct Situation;
+  class Item;
+  class ItemTable;
+  class ConcurrentItemTable;
+  class SetRefs;
+  struct ChartSet;
+  class Chart;
+  class ErrorChart;
+  template <size_t Words>
+  class BitChart;
+  class Automaton;
+  class AutomatonChart;
+  class SymbolNames;
+  class ForestBuilder;
+  class TreeBuilder;
+  template <class Builder>
+  class TracedChart;
   class Grammar;
 
-  using SituationHasher = Situation::SituationHasher;
-  using USetSits = USet<Situation, SituationHasher>;
-  // SetD consist if situations where dot is before nonterminal
-  using SetD = UMap<IndexT, USetSits>;
+  struct Options {
+    Mode mode = Mode::DottedRules;
+    bool lookahead = false;
+    bool bit_parallel = true;
+    bool keep_sets = false;  // sets are not released (Document)
+    size_t threads = 1;
+    bool all_spans = false;  // start item is added to every set (FindAll)
+    // Leo paths stop at rules of the start symbol (Classifier)
+    bool start_rules = false;
+    size_t beam = 0;
+    size_t spill = 0;  // resident sets, ignored with keep_sets
+    Score score;
+    std::shared_ptr<const Vector<double>> rule_weights;  // 1 if not set
+  };
 
   Grammar grammar_;
+  Options options_;
 
-  void Complete(const Situation& curr_sit, std::stack<Situation>& stk_sits,
-                USetSits& handled_sits) const;
-  void Predict(Situation curr_sit, SetD& set_d, std::stack<Situation>& stk_sits,
-               USetSits& handled_sits) const;
+  template <class Builder, class Result>
+  bool Trace(const std::basic_string<CharT>& word, Result& result) const;
   void Clear();
 };
 
+// Item of the chart: dotted rule and origin packed into 64 bits. Dotted rule
+// is the dense index of (rule id, dot) pair (see Grammar), so moving the dot
+// is just an increment of the upper half. In LR(0) mode the upper half keeps
+// a state of Automaton instead.
 template <typename CharT>
-struct BasicEarleyParser<CharT>::Situation {
+class BasicEarleyParser<CharT>::Item {
  public:
-  struct SituationHasher {
-    static constexpr size_t kMult1 = 0x9e3779b9;
-    static constexpr size_t kOff1 = 6;
-    static constexpr size_t kOff2 = 2;
-    struct VectorHasher {
-      constexpr size_t operator()(const Vector<IndexT>& vec) const {
-        size_t seed = vec.size();
-        for (IndexT elem : vec) {
-          seed ^= elem + kMult1 + (seed << kOff1) + (seed >> kOff2);
-        }
-        return seed;
-      }
-    };
-    constexpr size_t operator()(const Situation& sit) const {
-      return VectorHasher()(sit.right_part.get()) + (sit.left_symbol << kOff1) +
-             (sit.curr_pos >> kOff2);
-    }
-  };
+  Item() = default;
+  Item(uint32_t dotted, uint32_t origin)
+      : value_((uint64_t(dotted) << kOriginBits) | origin) {}
+
+  uint32_t Dotted() const { return uint32_t(value_ >> kOriginBits); }
+  uint32_t Origin() const { return uint32_t(value_); }
+  uint64_t Value() const { return value_; }
+  Item Next() const { return Item(value_ + (uint64_t(1) << kOriginBits)); }
+  bool operator==(const Item& item) const = default;
+  bool operator<(const Item& item) const { return value_ < item.value_; }
+
+ private:
+  static constexpr size_t kOriginBits = 32;
+  uint64_t value_ = 0;
 
-  RefW<const Vector<IndexT>> right_part;
-  RefW<const SetD> prev_d;
-  IndexT left_symbol;
-  size_t curr_pos;
-  Situation(RefW<const Vector<IndexT>> right_part, RefW<const SetD> prev_d,
-            IndexT left_symbol, size_t curr_pos = 0)
-      : right_part(right_part),
-        prev_d(prev_d),
-        left_symbol(left_symbol),
-        curr_pos(curr_pos) {}
-  bool RoolEnded() const { return curr_pos == right_part.get().size(); }
-  IndexT CurrSymbolInd() const { return right_part.get()[curr_pos]; }
-  bool operator==(const Situation& sit) const {
-    return &right_part.get() == &sit.right_part.get() &&
-           &prev_d.get() == &sit.prev_d.get() &&
-           left_symbol == sit.left_symbol && curr_pos == sit.curr_pos;
-  }
-  Situation(const Situation& sit)
-      : right_part(sit.right_part),
-        prev_d(sit.prev_d),
-        left_symbol(sit.left_symbol),
-        curr_pos(sit.curr_pos) {}
+  explicit Item(uint64_t value) : value_(value) {}
 };
 
+// Open addressing set of items of the chart set which is being built. Slots
+// keep indices into the items vector of the set and are tagged with
+// generation, so moving to the next set is O(1).
 template <typename CharT>
-class BasicEarleyParser<CharT>::Grammar : public GrammarBase<CharT> {
+class BasicEarleyParser<CharT>::ItemTable {
  public:
-  using RulesRightT = GrammarBase<CharT>::RulesRightT;
-  using RulesT = GrammarBase<CharT>::RulesT;
-  // todo: think how to make this function const
-  [[nodiscard]] Situation GetStartSituation(SetD& start_set) const {
-    assert(("Grammar is not set", !this->Empty()));
-    auto itr = this->rules_.find(this->kAuxiliaryStartSymbolInd);
-    return {std::cref(itr->second[0]), std::cref(start_set),
-            this->kAuxiliaryStartSymbolInd};
+  ItemTable() : slots_(kMinCapacity, 0) {}
+
+  // forgets previous set and indexes `items` that are already in the new one
+  void Reset(const Vector<Item>& items) {
+    if (++generation_ == 0) {
+      std::fill(slots_.begin(), slots_.end(), 0);
+      generation_ = 1;
+    }
+    Reserve(items);
+    for (size_t ind = 0; ind < items.size(); ++ind) {
+      Place(items, uint32_t(ind));
+    }
   }
-  [[nodiscard]] bool IsFinalSituation(const Situation& sit) const {
-    return sit.left_symbol == this->kAuxiliaryStartSymbolInd &&
-           sit.curr_pos == 1;
+
+  // appends `item` to `items` if it is not there yet,
+  // returns 'true' if item was appended
+  bool Insert(Vector<Item>& items, Item item) {
+    size_t slot = Find(items, item);
+    if (IsBusy(slots_[slot])) {
+      return false;
+    }
+    slots_[slot] = Tag(uint32_t(items.size()));
+    items.push_back(item);
+    if (2 * items.size() > slots_.size()) {
+      Reserve(items);
+    }
+    return true;
   }
-  // returns 'true' if grammar generate epsilon
-  [[nodiscard]] bool GenerateEpsilon() const {
-    return GenerateEpsilon(this->kStartSymbolInd);
+
+ private:
+  static constexpr size_t kMinCapacity = 16;
+  static constexpr uint64_t kMult = 0x9e3779b97f4a7c15;
+  static constexpr size_t kGenerationBits = 32;
+
+  Vector<uint64_t> slots_;  // generation in upper half, index in lower one
+  uint64_t generation_ = 0;
+
+  bool IsBusy(uint64_t slot) const {
+    return (slot >> kGenerationBits) == generation_;
   }
-  // returns 'true' if symbol generate epsilon
-  [[nodiscard]] bool GenerateEpsilon(IndexT symbol) const {
-    return proc_eps_generating_symbols_.contains(symbol);
+  uint64_t Tag(uint32_t ind) const {
+    return (generation_ << kGenerationBits) | ind;
   }
-  const RulesRightT& RightPart(IndexT left) const {
-    return rules_without_eps_.find(left)->second;
+  size_t Find(const Vector<Item>& items, Item item) const {
+    size_t mask = slots_.size() - 1;
+    size_t slot = (item.Value() * kMult) & mask;
+    while (IsBusy(slots_[slot]) && items[uint32_t(slots_[slot])] != item) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
   }
-
- protected:
-  void AfterRead() override {
-    // process epsilon generating symbols
-    UMap<IndexT, std::vector<USet<IndexT>>> rules_for_eps_generating;
-    RulesRightT right_parts_vec;
-    RulesRightT tmp;
-    for (auto& map : this->rules_) {
-      IndexT left = map.first;
-      std::vector<USet<IndexT>> right_parts_for_eps;
-      for (const auto& right : map.second) {
-        if (right[0] == this->kEpsilonInd) {
-          start_eps_generating_symbols_.insert(left);
-          proc_eps_generating_symbols_.insert(left);
-        } else {
-          right_parts_vec.push_back(right);
-          USet<IndexT> right_part;
-          for (auto symbol : (right)) {
-            right_part.insert(symbol);
-          }
-          right_parts_for_eps.push_back(std::move(right_part));
-        }
-      }
-      rules_without_eps_.insert({left, std::move(right_parts_vec)});
-      rules_for_eps_generating.insert({left, std::move(right_parts_for_eps)});
+  void Place(const Vector<Item>& items, uint32_t ind) {
+    slots_[Find(items, items[ind])] = Tag(ind);
+  }
+  void Reserve(const Vector<Item>& items) {
+    if (2 * items.size() <= slots_.size()) {
+      return;
+    }
+    size_t capacity = slots_.size();
+    while (2 * items.size() > capacity) {
+      capacity *= 2;
+    }
+    slots_.assign(capacity, 0);
+    for (size_t ind = 0; ind < items.size(); ++ind) {
+      Place(items, uint32_t(ind));
     }
-    ProcEpsGeneratingSymbols(rules_for_eps_generating);
   }
+};
 
-  void ProcEpsGeneratingSymbols(
-      UMap<IndexT, std::vector<USet<IndexT>>>& rules_for_eps_generating) {
-    if (proc_eps_generating_symbols_.empty()) {
-      return;
+// Set of items of the chart set which is closed by several threads. Slots
+// keep values of items and are claimed by compare-and-swap, so there is no
+// room for growth and the number of items is to be known beforehand.
+template <typename CharT>
+class BasicEarleyParser<CharT>::ConcurrentItemTable {
+ public:
+  // forgets previous set, indexes `items` and makes room for `count` items
+  void Reset(const Vector<Item>& items, size_t count) {
+    size_t capacity = std::bit_ceil(std::max(2 * count, kMinCapacity));
+    if (capacity > capacity_) {
+      slots_ = std::make_unique<std::atomic<uint64_t>[]>(capacity);
+      capacity_ = capacity;
     }
-    USet<IndexT> unhandled_smb;
-    for (IndexT i = 2; i <= this->nonterminals_count_ + 1; ++i) {
-      unhandled_smb.insert(i);
+    mask_ = capacity - 1;
+    for (size_t slot = 0; slot < capacity; ++slot) {
+      slots_[slot].store(kEmpty, std::memory_order_relaxed);
     }
-    std::stack<IndexT> stk;
-    for (IndexT ind : proc_eps_generating_symbols_) {
-      stk.push(ind);
-      unhandled_smb.erase(ind);
+    for (Item item : items) {
+      Insert(item);
     }
-    while (!stk.empty()) {
-      IndexT curr_ind = stk.top();
-      stk.pop();
-      auto it_curr = unhandled_smb.begin();
-      while (it_curr != unhandled_smb.end()) {
-        auto it_copy = it_curr;
-        auto iter = rules_for_eps_generating.find(*it_curr);
-        for (auto& right : iter->second) {
-          auto it_ind = right.begin();
-          while (it_ind != right.end()) {
-            if (*it_ind == curr_ind) {
-              it_ind = right.erase(it_ind);
-            } else {
-              ++it_ind;
-            }
-            if (right.empty()) {
-              proc_eps_generating_symbols_.insert(*it_curr);
-              stk.push(*it_curr);
-              it_curr = unhandled_smb.erase(it_curr);
-              break;
-            }
-          }
-        }
-        if (it_curr == it_copy) {  // if there were no deletion
-          ++it_curr;
-        }
+  }
+
+  // returns 'true' if `item` was not in the table,
+  // only one of the threads inserting it gets 'true'
+  bool Insert(Item item) {
+    uint64_t value = item.Value();
+    size_t slot = (value * kMult) & mask_;
+    while (true) {
+      uint64_t current = slots_[slot].load(std::memory_order_relaxed);
+      if (current == kEmpty &&
+          slots_[slot].compare_exchange_strong(current, value,
+                                               std::memory_order_relaxed)) {
+        return true;
+      }
+      if (current == value) {
+        return false;
       }
+      slot = (slot + 1) & mask_;
     }
   }
 
-  void AfterClear() override {
-    rules_without_eps_.clear();
-    start_eps_generating_symbols_.clear();
-    proc_eps_generating_symbols_.clear();
+ private:
+  static constexpr size_t kMinCapacity = 16;
+  static constexpr uint64_t kMult = 0x9e3779b97f4a7c15;
+  static constexpr uint64_t kEmpty = UINT64_MAX;  // value of kNoItem
+
+  std::unique_ptr<std::atomic<uint64_t>[]> slots_;
+  size_t capacity_ = 0;
+  size_t mask_ = 0;
+};
+
+// Reference counts of chart sets. Set is referenced by items of other kept
+// sets with origin in it and by Leo items memoized in them. Only the last set
+// may be needed without references, so the others are released as soon as
+// nothing refers to them. Chart drops references of released sets, which may
+// release more sets in turn.
+template <typename CharT>
+class BasicEarleyParser<CharT>::SetRefs {
+ public:
+  void AddSet() {
+    refs_.push_back(0);
+    ++sets_count_;
+    stats_.peak_sets = std::max(stats_.peak_sets, sets_count_);
+  }
+  void AddItems(size_t count) {
+    items_count_ += count;
+    stats_.items += count;
+    stats_.peak_items = std::max(stats_.peak_items, items_count_);
+  }
+  void Ref(size_t holder, size_t origin) {
+    if (origin != holder) {
+      ++refs_[origin];
+    }
+  }
+  void Unref(size_t holder, size_t origin) {
+    if (origin != holder && --refs_[origin] == 0) {
+      released_.push_back(origin);
+    }
   }
+  // `set_ind` is not the last set anymore
+  void Retire(size_t set_ind) {
+    if (refs_[set_ind] == 0) {
+      released_.push_back(set_ind);
+    }
+  }
+  // returns next set to release, its references are to be dropped
+  std::optional<size_t> PopReleased() {
+    if (released_.empty()) {
+      return std::nullopt;
+    }
+    size_t set_ind = released_.back();
+    released_.pop_back();
+    return set_ind;
+  }
+  void Release(size_t items_count) {
+    --sets_count_;
+    items_count_ -= items_count;
+  }
+  void Prune() { stats_.pruned = true; }
+  // `resident` items of the set leave memory, `written` of them go to the
+  // spill file
+  void Spill(size_t resident, size_t written) {
+    items_count_ -= resident;
+    stats_.spilled += written;
+  }
+  // sets from `sets_count` on are dropped without release (kept sets)
+  void Truncate(size_t sets_count) {
+    refs_.resize(sets_count);
+    sets_count_ = sets_count;
+  }
+  const Statistics& Stats() const { return stats_; }
 
  private:
-  RulesT rules_without_eps_;
-  USet<IndexT> start_eps_generating_symbols_;  // for printing source grammar
-  USet<IndexT> proc_eps_generating_symbols_;
+  Vector<uint32_t> refs_;  // index is set
+  Vector<size_t> released_;
+  size_t sets_count_ = 0;
+  size_t items_count_ = 0;
+  Statistics stats_;
 };
 
+// After the set is closed its items are sorted by the symbol after the dot,
+// so items waiting for one nonterminal and items scanning one terminal form
+// contiguous ranges.
 template <typename CharT>
-BasicEarleyParser<CharT>::BasicEarleyParser(const std::string& filename) {
-  EnterGrammar(filename);
-}
+struct BasicEarleyParser<CharT>::ChartSet {
+  Vector<Item> items;
+  // memoized transitive (Leo) items, sorted by nonterminal;
+  // kNoItem means that there is no deterministic reduction path
+  Vector<std::pair<IndexT, Item>> transitive;
+  size_t spilled = SIZE_MAX;  // record of the spill file instead of items
+};
 
 template <typename CharT>
-BasicEarleyParser<CharT>::BasicEarleyParser(std::basic_istream<CharT>& input) {
-  EnterGrammar(input);
-}
+class BasicEarleyParser<CharT>::Chart {
+ public:
+  Chart(const Grammar& grammar, const Options& options)
+      : grammar_(grammar), options_(options) {}
 
-template <typename CharT>
-void BasicEarleyParser<CharT>::EnterGrammar(const std::string& filename) {
-  std::wifstream file(filename);
-  EnterGrammar(file);
-}
+  void Start();
+  // scans `symbol` into the new set and closes it,
+  // returns 'false' if the new set is empty
+  bool Advance(IndexT symbol);
+  bool Accepted() const;
+  const Statistics& Stats() const { return refs_.Stats(); }
+  // less than the word length + 1 if the word is rejected before its end
+  size_t SetsCount() const { return sets_.size(); }
+  // adds pending predicted items, so the last set can be scanned by several
+  // symbols (without lookahead)
+  void SealLast();
+  // appends items of the sealed last set advanced over `symbol` to `items`
+  void Scan(IndexT symbol, Vector<Item>& items) const;
+  // closes the new set of `items`, which may repeat or be absent
+  void Push(Vector<Item> items);
+  // nonterminals of completed rules of the start symbol spanning the whole
+  // word (requires start_rules)
+  void StartRules(Vector<IndexT>& symbols) const;
+  // starts of nonempty spans derived from the start symbol and ending at the
+  // last set, sorted (requires all_spans)
+  void SpanStarts(Vector<uint32_t>& starts) const;
+  // drops the last set, so the previous one can be advanced by another
+  // symbol (requires keep_sets without lookahead)
+  void Pop();
+  // rebuilds sets after `start` for the new `word`, which is the old one
+  // before `start`; old sets are reused with origins shifted by `delta` as
+  // soon as a rebuilt set at `reuse_start` or later matches the old one,
+  // returns the number of rebuilt sets (requires keep_sets without lookahead)
+  size_t Reparse(std::span<const IndexT> word, size_t start,
+                 size_t reuse_start, int64_t delta);
 
-template <typename CharT>
-void BasicEarleyParser<CharT>::EnterGrammar(std::basic_istream<CharT>& input) {
-  Clear();
-  grammar_.Read(input);
-}
+ private:
+  static inline const Item kNoItem = Item(UINT32_MAX, UINT32_MAX);
 
-template <typename CharT>
-void BasicEarleyParser<CharT>::PrintGrammar(std::basic_ostream<CharT>& out) {
-  grammar_.Print(out);
-}
+  const Grammar& grammar_;
+  const Options& options_;
+  Vector<ChartSet> sets_;  // released sets are left empty
+  SetRefs refs_;
+  ItemTable table_;
+  Vector<size_t> predicted_;  // last set where nonterminal was predicted
+  Bitset predicted_items_;    // dotted rules predicted in the current set
+  // closure of big sets (threads option)
+  std::unique_ptr<utl::ThreadPool> pool_;
+  ConcurrentItemTable shared_table_;
+  Vector<Vector<Item>> found_;  // index is worker
+  std::unique_ptr<utl::SpillFile<Item>> spill_;
+
+  // items of the set enough to close the rest of it in parallel
+  static constexpr size_t kParallelItems = 1024;
+  static constexpr size_t kParallelChunk = 256;
 
+  void Close(size_t set_ind);
+  void CloseParallel(size_t set_ind, size_t ind);
+  void Prune(size_t set_ind);
+  void Complete(size_t set_ind, Item item);
+  std::optional<Item> Transitive(size_t set_ind, IndexT symbol);
+  void Predict(size_t set_ind, IndexT symbol);
+  void AddPredicted(size_t set_ind, IndexT lookahead);
+  void Seal(ChartSet& set) const;
+  void Retire(size_t set_ind);
+  void ReleaseUnused();
+  void Spill(size_t set_ind);
+  std::span<const Item> Items(const ChartSet& set) const;
+  std::span<const Item> Range(const ChartSet& set, IndexT symbol) const;
+  bool Matches(size_t set_ind, const ChartSet& old_set, size_t start,
+               const Vector<bool>& matched, int64_t delta) const;
+  void Shift(ChartSet& set, size_t from, int64_t delta) const;
+};
+
+// Chart for grammars with at most 64 * Words dotted rules. Set keeps a row
+// of dotted rules per origin instead of separate items, so the dot is moved
+// over a symbol in all items of the row at once: `(row & waiting) << 1`,
+// where `waiting` is the row of dotted rules with this symbol after the dot.
 template <typename CharT>
-bool BasicEarleyParser<CharT>::Parse(
-    const std::basic_string<CharT>& word) const {
-  assert(("Grammar is not set for Earley parser", !grammar_.Empty()));
-  if (word.empty()) {
-    return grammar_.GenerateEpsilon();
+template <size_t Words>
+class BasicEarleyParser<CharT>::BitChart {
+ public:
+  BitChart(const Grammar& grammar, const Options& options)
+      : grammar_(grammar), options_(options) {}
+
+  void Start();
+  bool Advance(IndexT symbol);
+  bool Accepted() const;
+  const Statistics& Stats() const { return refs_.Stats(); }
+
+ private:
+  using Row = std::array<uint64_t, Words>;
+
+  // items predicted in the set have it as origin and need no processing,
+  // so they are kept apart from the rows
+  struct RowSet {
+    Vector<std::pair<uint32_t, Row>> rows;  // origin and items
+    Row predicted{};
+    Vector<std::pair<IndexT, Item>> transitive;  // as in ChartSet
+  };
+
+  static inline const Item kNoItem = Item(UINT32_MAX, UINT32_MAX);
+
+  const Grammar& grammar_;
+  const Options& options_;
+  Vector<RowSet> sets_;  // released sets are left empty
+  SetRefs refs_;
+  Vector<uint32_t> row_ind_;  // index is origin, row in the current set
+  Vector<Row> pending_;       // not processed items of the current set rows
+  Vector<uint32_t> queue_;    // rows with pending items
+  Vector<size_t> predicted_;  // last set where nonterminal was predicted
+
+  void Close(size_t set_ind);
+  void Complete(size_t set_ind, size_t origin, IndexT symbol);
+  std::optional<Item> Transitive(size_t set_ind, IndexT symbol);
+  void Add(size_t set_ind, size_t origin, const Row& row);
+  void Retire(size_t set_ind);
+
+  static Row Advanced(const Row& row, const uint64_t* waiting) {
+    Row res;
+    uint64_t carry = 0;
+    for (size_t word = 0; word < Words; ++word) {
+      uint64_t bits = row[word] & waiting[word];
+      res[word] = (bits << 1) | carry;
+      carry = bits >> 63;
+    }
+    return res;
   }
-  std::vector<SetD> sets_vec(word.size() + 1);
-  USetSits handled_sits;
-  USetSits next_handle_sits;
-  std::stack<Situation> stk_sits;
-  std::stack<Situation> stk_next_d;
-  stk_next_d.push(grammar_.GetStartSituation(sets_vec[0]));
-  next_handle_sits.insert(stk_next_d.top());
-  for (size_t i = 0; i <= sets_vec.size(); ++i) {
-    handled_sits = std::move(next_handle_sits);
-    stk_sits = std::move(stk_next_d);
-    while (!stk_sits.empty()) {
-      Situation curr_sit = stk_sits.top();
-      stk_sits.pop();
-      if (i == word.size() && grammar_.IsFinalSituation(curr_sit)) {
-        return true;
-      }
-      if (curr_sit.RoolEnded()) {
-        Complete(std::move(curr_sit), stk_sits, handled_sits);
-      } else if (grammar_.IsNonterminal(curr_sit.CurrSymbolInd())) {
-        sets_vec[i][curr_sit.CurrSymbolInd()].insert(curr_sit);
-        Predict(std::move(curr_sit), sets_vec[i], stk_sits, handled_sits);
-      } else if (i < word.size() &&
-                 curr_sit.CurrSymbolInd() == grammar_.ToInd(word[i])) {
-        // scan()
-        ++curr_sit.curr_pos;
-        stk_next_d.push(curr_sit);
-        next_handle_sits.insert(std::move(curr_sit));
+  static bool Empty(const Row& row) {
+    uint64_t bits = 0;
+    for (uint64_t word : row) {
+      bits |= word;
+    }
+    return bits == 0;
+  }
+  static size_t Count(const Row& row) {
+    size_t count = 0;
+    for (uint64_t word : row) {
+      count += std::popcount(word);
+    }
+    return count;
+  }
+  template <class Func>
+  static void ForEach(const Row& row, const uint64_t* mask, Func func) {
+    for (size_t word = 0; word < Words; ++word) {
+      for (uint64_t bits = row[word] & mask[word]; bits != 0;
+           bits &= bits - 1) {
+        func(word * 64 + std::countr_zero(bits));
       }
     }
   }
-  return false;
-}
+};
 
+// Names of symbols for the parse results, leaves are the terminals of the word
+// rather than their classes.
 template <typename CharT>
-void BasicEarleyParser<CharT>::Complete(const Situation& curr_sit,
-                                        std::stack<Situation>& stk_sits,
-                                        USetSits& handled_sits) const {
-  auto itr = curr_sit.prev_d.get().find(curr_sit.left_symbol);
-  if (itr == curr_sit.prev_d.get().end()) {
-    return;
-  }
-  for (const auto& prev_sit : itr->second) {
-    Situation new_sit = {std::cref(prev_sit.right_part),
-                         std::cref(prev_sit.prev_d), prev_sit.left_symbol,
-                         prev_sit.curr_pos + 1};
-    if (!handled_sits.contains(new_sit)) {
-      handled_sits.insert(new_sit);
-      stk_sits.push(std::move(new_sit));
+class BasicEarleyParser<CharT>::SymbolNames {
+ public:
+  void Assign(const Grammar& grammar) {
+    terminals_count_ = grammar.SourceTerminalsCount();
+    names_.clear();
+    for (IndexT symbol = -terminals_count_;
+         symbol <= grammar.NonterminalsCount() + 1; ++symbol) {
+      names_.push_back(grammar.ToStr(symbol));
     }
   }
-}
+  const String& operator()(IndexT symbol) const {
+    return names_[size_t(symbol + terminals_count_)];
+  }
 
+ private:
+  Vector<String> names_;  // index is symbol + terminals count
+  IndexT terminals_count_ = 0;
+};
+
+// Shared packed parse forest. Node is a symbol with the span of the word it
+// derives, its packed children are the derivations. Forest is binarized:
+// intermediate nodes stand for prefixes of rules, so each derivation has at
+// most two children. Nullable symbols spanning nothing have no children.
 template <typename CharT>
-void BasicEarleyParser<CharT>::Predict(Situation curr_sit, SetD& set_d,
-                                       std::stack<Situation>& stk_sits,
-                                       USetSits& handled_sits) const {
-  IndexT left_part = curr_sit.CurrSymbolInd();
-  if (grammar_.GenerateEpsilon(left_part)) {
-    ++curr_sit.curr_pos;
-    if (!handled_sits.contains(curr_sit)) {
-      handled_sits.insert(curr_sit);
-      stk_sits.push(curr_sit);
-    }
+class BasicEarleyParser<CharT>::Forest {
+ public:
+  static constexpr uint32_t kNoNode = UINT32_MAX;
+
+  struct Node {
+    IndexT symbol;  // left side of the rule for intermediate node
+    bool intermediate;
+    uint32_t start;
+    uint32_t end;
+  };
+  // `left` is kNoNode if the derivation has one child
+  struct Packed {
+    uint32_t left;
+    uint32_t right;
+    auto operator<=>(const Packed& packed) const = default;
+  };
+
+  // kNoNode if the word is not accepted
+  [[nodiscard]] uint32_t Root() const { return root_; }
+  [[nodiscard]] size_t NodesCount() const { return nodes_.size(); }
+  [[nodiscard]] const Node& GetNode(uint32_t node) const {
+    return nodes_[node];
   }
-  for (const auto& right_part : grammar_.RightPart(left_part)) {
-    Situation new_sit = {std::cref(right_part), std::cref(set_d), left_part};
-    if (!handled_sits.contains(new_sit)) {
-      handled_sits.insert(new_sit);
-      stk_sits.push(std::move(new_sit));
-    }
+  [[nodiscard]] std::span<const Packed> Children(uint32_t node) const {
+    return {packed_.begin() + first_packed_[node],
+            packed_.begin() + first_packed_[node + 1]};
   }
-}
+  [[nodiscard]] const String& SymbolStr(IndexT symbol) const {
+    return names_(symbol);
+  }
+
+ private:
+  friend class ForestBuilder;
+
+  Vector<Node> nodes_;
+  Vector<Packed> packed_;          // grouped by node
+  Vector<uint32_t> first_packed_;  // index is node
+  Vector<uint32_t> packed_nodes_;  // nodes of `packed_` while building
+  SymbolNames names_;
+  uint32_t root_ = kNoNode;
+
+  void Clear();
+  uint32_t AddNode(IndexT symbol, bool intermediate, size_t start,
+                   size_t end);
+  void AddPacked(uint32_t node, uint32_t left, uint32_t right);
+  void Seal(uint32_t root);
+};
 
+// One derivation of the word. Children of the node are the symbols of its
+// rule, nullable symbols spanning nothing have no children.
 template <typename CharT>
-void BasicEarleyParser<CharT>::Clear() {
-  grammar_.Clear();
+class BasicEarleyParser<CharT>::Tree {
+ public:
+  static constexpr uint32_t kNoNode = UINT32_MAX;
+
+  struct Node {
+    IndexT symbol;
+    uint32_t start;
+    uint32_t end;
+  };
+
+  // kNoNode if the word is not accepted
+  [[nodiscard]] uint32_t Root() const { return root_; }
+  [[nodiscard]] size_t NodesCount() const { return nodes_.size(); }
+  [[nodiscard]] const Node& GetNode(uint32_t node) const {
+    return nodes_[node];
+  }
+  [[nodiscard]] std::span<const uint32_t> Children(uint32_t node) const {
+    return {children_.begin() + first_child_[node],
+            children_.begin() + first_child_[node + 1]};
+  }
+  [[nodiscard]] const String& SymbolStr(IndexT symbol) const {
+    return names_(symbol);
+  }
+
+ private:
+  friend class TreeBuilder;
+
+  Vector<Node> nodes_;
+  Vector<uint32_t> children_;     // grouped by node
+  Vector<uint32_t> first_child_;  // index is node
+  SymbolNames names_;
+  uint32_t root_ = kNoNode;
+};
+
+// Nonempty spans of the text derived from the start symbol.
+template <typename CharT>
+class BasicEarleyParser<CharT>::SpanIndex {
+ public:
+  [[nodiscard]] bool Contains(size_t start, size_t end) const {
+    return spans_.contains(Key(start, end));
+  }
+  [[nodiscard]] size_t Size() const { return spans_.size(); }
+
+ private:
+  friend class BasicEarleyParser;
+
+  USet<uint64_t> spans_;
+
+  static uint64_t Key(size_t start, size_t end) {
+    return (uint64_t(start) << 32) | end;
+  }
+};
+
+// Recognizer of several grammars at once. The grammars are merged into one
+// (see Grammar::Merge()), so one chart tells all of the grammars deriving the
+// word: rules of the start symbol are left on Leo paths, so the completed
+// rule for the start symbol of each such grammar is in the last set.
+template <typename CharT>
+class BasicEarleyParser<CharT>::Classifier {
+ public:
+  explicit Classifier(const std::vector<std::string>& filenames);
+
+  // indices of the grammars deriving the word, increasing
+  [[nodiscard]] std::vector<size_t> Parse(
+      const std::basic_string<CharT>& word) const;
+  // the merged grammar
+  void PrintGrammar(std::basic_ostream<CharT>& out) const;
+
+ private:
+  Grammar grammar_;
+  Options options_;
+  Vector<IndexT> starts_;  // index is grammar
+};
+
+// Word with its chart kept between edits. Sets before the edit are reused,
+// sets after it are rebuilt until one of them matches the old set at the same
+// place of the text, and the rest of the old sets is reused then. So the cost
+// of the edit depends on how far its effect reaches rather than on the length
+// of the word. Lookahead and bit rows are not used, the parser must outlive
+// the document.
+template <typename CharT>
+class BasicEarleyParser<CharT>::Document {
+ public:
+  Document(const BasicEarleyParser& parser,
+           const std::basic_string<CharT>& word = {});
+
+  // replaces `deleted` symbols from `offset` with `inserted`,
+  // returns 'true' if the new word is accepted
+  bool Edit(size_t offset, size_t deleted,
+            const std::basic_string<CharT>& inserted);
+  [[nodiscard]] bool Accepted() const;
+  [[nodiscard]] const std::basic_string<CharT>& Word() const { return word_; }
+  // sets rebuilt by the last edit
+  [[nodiscard]] size_t RebuiltSets() const { return rebuilt_; }
+
+ private:
+  const Grammar& grammar_;
+  Options options_;
+  Chart chart_;
+  std::basic_string<CharT> word_;
+  Vector<IndexT> symbols_;
+  size_t rebuilt_ = 0;
+};
+
+// Error-correcting chart (Aho-Peterson): every item keeps the least number of
+// edits of its span, items with more than `max_errors` edits are dropped. A
+// terminal after the dot may be inserted, the read symbol may be deleted by
+// copying the items to the next set or substituted when terminals are
+// scanned. Items predicted in the set only insert symbols, so they get
+// MinLength() of the symbols before the dot at once. Other items are closed
+// in order of errors (Dijkstra's algorithm with buckets), so each of them is
+// closed once with the least count. Each set keeps a lower bound of errors of
+// its prefix, and items whose errors together with the bound of their origin
+// are too many are dropped too.
+template <typename CharT>
+class BasicEarleyParser<CharT>::ErrorChart {
+ public:
+  ErrorChart(const Grammar& grammar, size_t max_errors)
+      : grammar_(grammar), max_errors_(max_errors) {}
+
+  void Start();
+  // returns 'false' if every item has too many errors
+  bool Advance(IndexT symbol);
+  // errors of the word read so far
+  [[nodiscard]] std::optional<size_t> Errors() const;
+
+ private:
+  using Entry = std::pair<Item, size_t>;  // item and its errors
+  struct ErrorSet {
+    Vector<Entry> items;
+    UMap<IndexT, Vector<Entry>> waiting;  // items by the symbol after the dot
+    size_t prefix_errors = SIZE_MAX;
+  };
+
+  const Grammar& grammar_;
+  size_t max_errors_;
+  Vector<ErrorSet> sets_;
+  Vector<size_t> predicted_;  // index of the last set, index is nonterminal
+  // the set which is being closed
+  Vector<Vector<Item>> buckets_;                  // index is errors
+  UMap<uint64_t, std::pair<size_t, bool>> best_;  // errors and 'closed' flag
+
+  void Add(Item item, size_t errors);
+  void Close();
+  void Keep(Item item, size_t errors);
+  void Predict(IndexT symbol);
+  void PredictRule(uint32_t first);
+};
+
+// Item chart where each item keeps a value made by Builder from the value of
+// the item it is advanced from and the value of the symbol it is advanced
+// over, so derivations can be restored. Leo items are not used, since they
+// skip items of the reduction path.
+template <typename CharT>
+template <class Builder>
+class BasicEarleyParser<CharT>::TracedChart {
+ public:
+  TracedChart(const Grammar& grammar, Builder& builder)
+      : grammar_(grammar), builder_(builder) {}
+
+  void Start();
+  bool Advance(IndexT symbol);
+  // passes the value of the accepting item to the builder,
+  // returns 'false' if there is no such item
+  bool Finish();
+
+ private:
+  const Grammar& grammar_;
+  Builder& builder_;
+  bool rejected_ = false;
+  // closed sets, items are sorted as in Chart and paired with their values
+  Vector<Vector<std::pair<Item, uint32_t>>> sets_;
+  Vector<Item> items_;  // current set
+  Vector<uint32_t> values_;
+  ItemTable table_;
+  Vector<size_t> predicted_;  // last set where nonterminal was predicted
+
+  void Close(size_t set_ind);
+  void Add(size_t set_ind, Item item, uint32_t prev, uint32_t symbol);
+  void Seal();
+  std::span<const std::pair<Item, uint32_t>> Range(size_t set_ind,
+                                                   IndexT symbol) const;
+};
+
+// Builds Forest along with the chart (Scott, 2008). Node of the item
+// (A -> x.y, j) in set i is labelled with A -> x for non-empty rule prefix
+// and with A for completed items, so derivations of one symbol over one span
+// share the node.
+template <typename CharT>
+class BasicEarleyParser<CharT>::ForestBuilder {
+ public:
+  static constexpr uint32_t kNone = Forest::kNoNode;
+  // new derivations of known items are kept too
+  static constexpr bool kAllDerivations = true;
+
+  ForestBuilder(const Grammar& grammar, const String& word, Forest& forest);
+
+  uint32_t Terminal(size_t set_ind, IndexT symbol);
+  uint32_t Empty(size_t set_ind, IndexT symbol);
+  uint32_t Derive(size_t set_ind, Item item, uint32_t prev, uint32_t symbol);
+  void NextSet() { labels_.clear(); }
+  bool Finish(size_t set_ind, std::optional<uint32_t> accepting);
+
+ private:
+  static constexpr uint64_t kSymbolKey = uint64_t(1) << 63;
+
+  const Grammar& grammar_;
+  const String& word_;
+  Forest& forest_;
+  UMap<uint64_t, uint32_t> labels_;  // nodes ending in the current set
+
+  uint32_t SymbolNode(size_t set_ind, IndexT symbol, size_t start);
+};
+
+// Keeps one derivation of each item: the item it is advanced from and the
+// completed item of the symbol it is advanced over. Tree is restored from
+// these links only when the word is accepted.
+template <typename CharT>
+class BasicEarleyParser<CharT>::TreeBuilder {
+ public:
+  static constexpr uint32_t kNone = UINT32_MAX;
+  static constexpr bool kAllDerivations = false;
+
+  TreeBuilder(const Grammar& grammar, const String& word, Tree& tree);
+
+  uint32_t Terminal(size_t /*set_ind*/, IndexT /*symbol*/) {
+    return kTerminal;
+  }
+  uint32_t Empty(size_t /*set_ind*/, IndexT /*symbol*/) { return kEmpty; }
+  uint32_t Derive(size_t /*set_ind*/, Item item, uint32_t prev,
+                  uint32_t symbol) {
+    links_.push_back({item.Dotted(), prev, symbol});
+    return uint32_t(links_.size() - 1);
+  }
+  void NextSet() {}
+  bool Finish(size_t set_ind, std::optional<uint32_t> accepting);
+
+ private:
+  static constexpr uint32_t kTerminal = kNone - 1;
+  static constexpr uint32_t kEmpty = kNone - 2;
+
+  struct Link {
+    uint32_t dotted;
+    uint32_t prev;    // kNone for the item with the dot at the beginning
+    uint32_t symbol;  // link of completed item, kTerminal or kEmpty
+  };
+
+  const Grammar& grammar_;
+  const String& word_;
+  Tree& tree_;
+  Vector<Link> links_;
+
+  uint32_t AddNode(IndexT symbol, size_t end, uint32_t link);
+};
+
+// LR(0) automaton with nullable symbols folded in (Aycock, Horspool, 2002).
+// Items of the states are dotted rules. Each state is split in two: the
+// kernel part keeps the origin of the items it came from, while the part
+// predicted by it is entered by epsilon transition and gets the current set
+// as origin.
+template <typename CharT>
+class BasicEarleyParser<CharT>::Automaton {
+ public:
+  static constexpr uint32_t kNoState = UINT32_MAX;
+
+  void Build(const Grammar& grammar);
+  void Clear();
+
+  [[nodiscard]] uint32_t Start() const { return 0; }
+  [[nodiscard]] uint32_t Goto(uint32_t state, IndexT symbol) const {
+    return goto_[state * width_ + size_t(symbol + terminals_count_)];
+  }
+  // state of items predicted by `state`, kNoState if there is nothing new
+  [[nodiscard]] uint32_t EpsilonGoto(uint32_t state) const {
+    return epsilon_goto_[state];
+  }
+  // left nonterminals of rules completed in `state`
+  [[nodiscard]] const Vector<IndexT>& Completed(uint32_t state) const {
+    return completed_[state];
+  }
+  // nonterminals with transitions from `state`
+  [[nodiscard]] const Vector<IndexT>& Waiting(uint32_t state) const {
+    return waiting_[state];
+  }
+  [[nodiscard]] bool Accepting(uint32_t state) const {
+    return accepting_[state];
+  }
+  [[nodiscard]] size_t StatesCount() const { return epsilon_goto_.size(); }
+
+ private:
+  IndexT terminals_count_ = 0;
+  size_t width_ = 0;
+  Vector<uint32_t> goto_;  // index is state * width_ + symbol offset
+  Vector<uint32_t> epsilon_goto_;
+  Vector<Vector<IndexT>> completed_;
+  Vector<Vector<IndexT>> waiting_;
+  Vector<bool> accepting_;
+
+  static Vector<uint32_t> Kernel(const Grammar& grammar,
+                                 Vector<uint32_t> items);
+  static Vector<uint32_t> Predicted(const Grammar& grammar,
+                                    const Vector<uint32_t>& items);
+};
+
+// Chart whose items are states of Automaton with origins.
+template <typename CharT>
+class BasicEarleyParser<CharT>::AutomatonChart {
+ public:
+  AutomatonChart(const Grammar& grammar, const Options& /*options*/)
+      : grammar_(grammar), automaton_(grammar.GetAutomaton()) {}
+
+  void Start();
+  bool Advance(IndexT symbol);
+  bool Accepted() const;
+  const Statistics& Stats() const { return refs_.Stats(); }
+
+ private:
+  // `waiting` pairs items with nonterminals they have transitions by
+  struct StateSet {
+    Vector<Item> items;
+    Vector<std::pair<IndexT, Item>> waiting;
+  };
+
+  const Grammar& grammar_;
+  const Automaton& automaton_;
+  Vector<StateSet> sets_;  // released sets are left empty
+  SetRefs refs_;
+  ItemTable table_;
+
+  void Close(size_t set_ind);
+  void Add(size_t set_ind, uint32_t state, size_t origin);
+  void Seal(StateSet& set) const;
+  void Retire(size_t set_ind);
+};
+
+// Recognizer fed with the word by parts. Each symbol is scanned as soon as it
+// is fed and the chart dies on the first symbol that can't continue the
+// prefix, if every nonterminal of the grammar derives some word. The chart is
+// chosen as in Parse(), the parser must outlive the recognizer.
+template <typename CharT>
+class BasicEarleyParser<CharT>::Recognizer {
+ public:
+  explicit Recognizer(const BasicEarleyParser& parser);
+  Recognizer(const Recognizer&) = delete;
+  Recognizer& operator=(const Recognizer&) = delete;
+
+  // symbols fed after the prefix has died are ignored,
+  // returns IsViablePrefix()
+  bool Feed(std::span<const CharT> symbols);
+  // 'false' if no word starts with the fed symbols
+  [[nodiscard]] bool IsViablePrefix() const { return viable_; }
+  // returns 'true' if the fed symbols form an accepted word
+  [[nodiscard]] bool Finish() const;
+  [[nodiscard]] const Statistics& Stats() const;
+
+ private:
+  const Grammar& grammar_;
+  Options options_;
+  std::variant<Chart, BitChart<1>, BitChart<2>, BitChart<4>, BitChart<8>,
+               AutomatonChart>
+      chart_;
+  size_t fed_ = 0;
+  bool viable_ = true;
+};
+
+template <typename CharT>
+class BasicEarleyParser<CharT>::Grammar : public GrammarBase<CharT> {
+ public:
+  using RulesRightT = GrammarBase<CharT>::RulesRightT;
+  using RulesT = GrammarBase<CharT>::RulesT;
+
+  [[nodiscard]] uint32_t StartDotted() const {
+    assert(("Grammar is not set", !this->Empty()));
+    return predictions_[this->kAuxiliaryStartSymbolInd][0];
+  }
+  [[nodiscard]] uint32_t FinalDotted() const { return StartDotted() + 1; }
+  // returns 'true' if the dot is at the beginning of the rule
+  [[nodiscard]] bool RuleStart(uint32_t dotted) const {
+    return dotted == 0 || dotted_symbol_[dotted - 1] == this->kEpsilonInd;
+  }
+  // returns 'true' if grammar generate epsilon
+  [[nodiscard]] bool GenerateEpsilon() const {
+    return GenerateEpsilon(this->kStartSymbolInd);
+  }
+  // returns 'true' if symbol generate epsilon
+  [[nodiscard]] bool GenerateEpsilon(IndexT symbol) const {
+    return nullable_[symbol];
+  }
+  // symbol after the dot, kEpsilonInd if the rule is ended
+  [[nodiscard]] IndexT NextSymbol(uint32_t dotted) const {
+    return dotted_symbol_[dotted];
+  }
+  [[nodiscard]] IndexT Left(uint32_t dotted) const {
+    return dotted_left_[dotted];
+  }
+  // dotted rules with the dot at the beginning of each rule of `left`
+  [[nodiscard]] const Vector<uint32_t>& Predictions(IndexT left) const {
+    return predictions_[left];
+  }
+  // dotted rules predicted by `left` transitively, including ones with the
+  // dot moved over nullable symbols
+  [[nodiscard]] const Bitset& Closure(IndexT left) const {
+    return closures_[left];
+  }
+  [[nodiscard]] size_t DottedCount() const { return dotted_symbol_.size(); }
+  // length of the shortest word derived from the nonterminal, SIZE_MAX if
+  // there is no such word
+  [[nodiscard]] size_t MinLength(IndexT symbol) const {
+    return min_lengths_[symbol];
+  }
+  static constexpr uint32_t kNoRule = UINT32_MAX;
+  // number of the rule over classes of terminals in order of nonterminals and
+  // then of their alternatives, kNoRule for the auxiliary rule
+  [[nodiscard]] uint32_t Rule(uint32_t dotted) const {
+    return dotted_rule_[dotted];
+  }
+  // position of the dot in the rule
+  [[nodiscard]] uint32_t Dot(uint32_t dotted) const {
+    return dotted - rule_begin_[dotted_rule_[dotted]];
+  }
+  // rules over classes of terminals
+  [[nodiscard]] size_t RulesCount() const { return rule_begin_.size(); }
+  // rules of the grammar file, numbered in the same way
+  [[nodiscard]] size_t SourceRulesCount() const { return class_rule_.size(); }
+  // rule made of the rule of the grammar file
+  [[nodiscard]] uint32_t ClassRule(uint32_t source_rule) const {
+    return class_rule_[source_rule];
+  }
+  // first rule of the grammar file the rule is made of
+  [[nodiscard]] uint32_t SourceRule(uint32_t rule) const {
+    return source_rule_[rule];
+  }
+  // dotted rules whose rest can derive a string starting with `terminal`
+  [[nodiscard]] const Bitset& Starters(IndexT terminal) const {
+    return starters_[-terminal - 1];
+  }
+  [[nodiscard]] const Automaton& GetAutomaton() const { return automaton_; }
+  // number of 64-bit words in rows of BitChart, 0 if the grammar doesn't fit
+  [[nodiscard]] size_t BitWords() const { return bit_words_; }
+  // rows of dotted rules with `symbol` after the dot,
+  // completed ones for kEpsilonInd
+  [[nodiscard]] const uint64_t* WaitingRow(IndexT symbol) const {
+    return &waiting_rows_[size_t(symbol + this->terminals_count_) *
+                          bit_words_];
+  }
+  [[nodiscard]] const uint64_t* ClosureRow(IndexT left) const {
+    return &closure_rows_[size_t(left) * bit_words_];
+  }
+  [[nodiscard]] const uint64_t* StartersRow(IndexT terminal) const {
+    return &starter_rows_[size_t(-terminal - 1) * bit_words_];
+  }
+  // dotted rules with nonterminal after the dot
+  [[nodiscard]] const uint64_t* PredictingRow() const {
+    return predicting_row_.data();
+  }
+  // dotted rules with nullable nonterminal after the dot
+  [[nodiscard]] const uint64_t* NullableNextRow() const {
+    return nullable_next_row_.data();
+  }
+
+  // Makes the grammar whose start symbol has a unit rule for the start symbol
+  // of each of `grammars`. Terminals are shared by their symbols, and
+  // nonterminals with the same rules up to such sharing are merged, so common
+  // parts of the grammars are predicted and completed once. Returns the
+  // nonterminals standing for the start symbols of the grammars.
+  Vector<IndexT> Merge(const Vector<Grammar>& grammars) {
+    this->Clear();
+    AfterClear();
+    // rules over terminals of the merged grammar and numbered nonterminals
+    // of all grammars (nodes), node `n` is `n + 1`
+    Vector<String> terminals;
+    UMap<String, IndexT> terminal_inds;
+    Vector<size_t> first_node(grammars.size() + 1, 0);
+    Vector<RulesRightT> node_rules;
+    Vector<String> node_names;
+    for (size_t ind = 0; ind < grammars.size(); ++ind) {
+      const Grammar& grammar = grammars[ind];
+      first_node[ind + 1] = first_node[ind] + grammar.nonterminals_count_;
+      auto to_merged = [&](IndexT symbol) -> IndexT {
+        if (grammar.IsNonterminal(symbol)) {
+          return IndexT(first_node[ind] + symbol - 1);
+        }
+        if (symbol == this->kEpsilonInd) {
+          return symbol;
+        }
+        const String& name = grammar.ToStr(symbol);
+        auto [iter, inserted] =
+            terminal_inds.try_emplace(name, -IndexT(terminals.size()) - 1);
+        if (inserted) {
+          terminals.push_back(name);
+        }
+        return iter->second;
+      };
+      for (IndexT left = this->kStartSymbolInd;
+           left <= grammar.nonterminals_count_ + 1; ++left) {
+        RulesRightT rules;
+        for (const auto& right : grammar.source_rules_.find(left)->second) {
+          rules.emplace_back(right.size());
+          std::ranges::transform(right, rules.back().begin(), to_merged);
+        }
+        node_rules.push_back(std::move(rules));
+        node_names.push_back(grammar.ToStr(left) + CharT('_') +
+                             this->FromAscii(std::to_string(ind)));
+      }
+    }
+    // partition refinement: nodes stay in one class while their rules are
+    // the same up to classes
+    size_t nodes_count = node_rules.size();
+    Vector<size_t> node_class(nodes_count, 0);
+    size_t classes_count = 1;
+    auto class_rules = [&node_class](const RulesRightT& rules) {
+      RulesRightT res = rules;
+      for (auto& right : res) {
+        for (IndexT& symbol : right) {
+          if (symbol > 0) {
+            symbol = IndexT(node_class[symbol - 1]) + 1;
+          }
+        }
+      }
+      std::ranges::sort(res);
+      res.erase(std::unique(res.begin(), res.end()), res.end());
+      return res;
+    };
+    while (true) {
+      std::map<std::pair<size_t, RulesRightT>, size_t> classes;
+      Vector<size_t> next_class(nodes_count);
+      for (size_t node = 0; node < nodes_count; ++node) {
+        auto key = std::pair(node_class[node], class_rules(node_rules[node]));
+        next_class[node] =
+            classes.try_emplace(std::move(key), classes.size()).first->second;
+      }
+      node_class = std::move(next_class);
+      if (classes.size() == classes_count) {
+        break;
+      }
+      classes_count = classes.size();
+    }
+    // class `c` is nonterminal `c + 3`, 2 is the new start symbol
+    auto add_symbol = [this](IndexT ind, const String& name) {
+      this->map_ind_str_.insert({ind, name});
+      this->map_str_ind_.insert({name, ind});
+    };
+    add_symbol(this->kEpsilonInd, this->FromAscii("EPSILON"));
+    add_symbol(this->kAuxiliaryStartSymbolInd, this->kAuxiliaryStr);
+    add_symbol(this->kStartSymbolInd, this->FromAscii("START"));
+    for (size_t ind = 0; ind < terminals.size(); ++ind) {
+      add_symbol(-IndexT(ind) - 1, terminals[ind]);
+    }
+    this->terminals_count_ = IndexT(terminals.size());
+    this->nonterminals_count_ = IndexT(classes_count) + 1;
+    this->rules_.insert({this->kAuxiliaryStartSymbolInd,
+                         {{this->kStartSymbolInd}}});
+    for (size_t node = 0; node < nodes_count; ++node) {
+      IndexT symbol = IndexT(node_class[node]) + 3;
+      if (this->rules_.contains(symbol)) {
+        continue;
+      }
+      add_symbol(symbol, node_names[node]);
+      RulesRightT rules = class_rules(node_rules[node]);
+      for (auto& right : rules) {
+        for (IndexT& right_symbol : right) {
+          right_symbol += (right_symbol > 0) ? 2 : 0;
+        }
+      }
+      this->rules_.insert({symbol, std::move(rules)});
+    }
+    Vector<IndexT> starts;
+    RulesRightT& start_rules = this->rules_[this->kStartSymbolInd];
+    for (size_t ind = 0; ind < grammars.size(); ++ind) {
+      starts.push_back(IndexT(node_class[first_node[ind]]) + 3);
+      if (std::ranges::find(start_rules, Vector<IndexT>{starts.back()}) ==
+          start_rules.end()) {
+        start_rules.push_back({starts.back()});
+      }
+    }
+    this->CreateTerminalClasses();
+    this->CreateSymbolMap();
+    AfterRead();
+    return starts;
+  }
+
+ protected:
+  void AfterRead() override {
+    // process epsilon generating symbols
+    UMap<IndexT, std::vector<USet<IndexT>>> rules_for_eps_generating;
+    for (auto& map : this->rules_) {
+      IndexT left = map.first;
+      std::vector<USet<IndexT>> right_parts_for_eps;
+      for (const auto& right : map.second) {
+        if (right[0] == this->kEpsilonInd) {
+          start_eps_generating_symbols_.insert(left);
+          proc_eps_generating_symbols_.insert(left);
+        } else {
+          USet<IndexT> right_part;
+          for (auto symbol : (right)) {
+            right_part.insert(symbol);
+          }
+          right_parts_for_eps.push_back(std::move(right_part));
+        }
+      }
+      rules_for_eps_generating.insert({left, std::move(right_parts_for_eps)});
+    }
+    ProcEpsGeneratingSymbols(rules_for_eps_generating);
+    CreateDottedRules();
+    CreateMinLengths();
+    CreateClosures();
+    CreateStarters();
+    CreateBitRows();
+    automaton_.Build(*this);
+  }
+
+  void ProcEpsGeneratingSymbols(
+      UMap<IndexT, std::vector<USet<IndexT>>>& rules_for_eps_generating) {
+    if (proc_eps_generating_symbols_.empty()) {
+      return;
+    }
+    USet<IndexT> unhandled_smb;
+    for (IndexT i = 2; i <= this->nonterminals_count_ + 1; ++i) {
+      unhandled_smb.insert(i);
+    }
+    std::stack<IndexT> stk;
+    for (IndexT ind : proc_eps_generating_symbols_) {
+      stk.push(ind);
+      unhandled_smb.erase(ind);
+    }
+    while (!stk.empty()) {
+      IndexT curr_ind = stk.top();
+      stk.pop();
+      auto it_curr = unhandled_smb.begin();
+      while (it_curr != unhandled_smb.end()) {
+        auto it_copy = it_curr;
+        auto iter = rules_for_eps_generating.find(*it_curr);
+        for (auto& right : iter->second) {
+          right.erase(curr_ind);
+          if (right.empty()) {
+            proc_eps_generating_symbols_.insert(*it_curr);
+            stk.push(*it_curr);
+            it_curr = unhandled_smb.erase(it_curr);
+            break;
+          }
+        }
+        if (it_curr == it_copy) {  // if there were no deletion
+          ++it_curr;
+        }
+      }
+    }
+  }
+
+  // Rules are laid out one after another, rule of length `n` takes `n + 1`
+  // dotted rules: the dotted rule of rule `r` with dot at `pos` has index
+  // begin(r) + pos and the last one is marked with kEpsilonInd.
+  void CreateDottedRules() {
+    IndexT max_ind = this->nonterminals_count_ + 1;
+    predictions_.assign(max_ind + 1, {});
+    nullable_.assign(max_ind + 1, false);
+    for (IndexT left = this->kAuxiliaryStartSymbolInd; left <= max_ind;
+         ++left) {
+      nullable_[left] = proc_eps_generating_symbols_.contains(left);
+      if (left != this->kAuxiliaryStartSymbolInd) {
+        // alternatives over classes are in order of their first source ones
+        auto first_rule = uint32_t(rule_begin_.size());
+        for (size_t alternative : this->source_rule_class_.find(left)->second) {
+          auto rule = uint32_t(first_rule + alternative);
+          if (rule == source_rule_.size()) {
+            source_rule_.push_back(uint32_t(class_rule_.size()));
+          }
+          class_rule_.push_back(rule);
+        }
+      }
+      for (const auto& right : this->rules_.find(left)->second) {
+        uint32_t rule = kNoRule;
+        if (left != this->kAuxiliaryStartSymbolInd) {
+          rule = uint32_t(rule_begin_.size());
+          rule_begin_.push_back(uint32_t(dotted_symbol_.size()));
+        }
+        if (right[0] == this->kEpsilonInd) {
+          continue;
+        }
+        predictions_[left].push_back(uint32_t(dotted_symbol_.size()));
+        for (IndexT symbol : right) {
+          if (symbol != this->kEpsilonInd) {
+            dotted_symbol_.push_back(symbol);
+            dotted_left_.push_back(left);
+            dotted_rule_.push_back(rule);
+          }
+        }
+        dotted_symbol_.push_back(this->kEpsilonInd);
+        dotted_left_.push_back(left);
+        dotted_rule_.push_back(rule);
+      }
+    }
+    assert(("Too many rules", dotted_symbol_.size() <= UINT32_MAX));
+  }
+
+  // fixed point of lengths of rules, rules are rescanned while some length
+  // goes down
+  void CreateMinLengths() {
+    min_lengths_.assign(this->nonterminals_count_ + 2, SIZE_MAX);
+    for (IndexT left = this->kStartSymbolInd; left < IndexT(nullable_.size());
+         ++left) {
+      if (nullable_[left]) {
+        min_lengths_[left] = 0;
+      }
+    }
+    for (bool changed = true; changed;) {
+      changed = false;
+      size_t length = 0;
+      for (uint32_t dotted = 0; dotted < DottedCount(); ++dotted) {
+        IndexT symbol = dotted_symbol_[dotted];
+        if (symbol == this->kEpsilonInd) {
+          size_t& min_length = min_lengths_[dotted_left_[dotted]];
+          if (length < min_length) {
+            min_length = length;
+            changed = true;
+          }
+          length = 0;
+        } else if (length != SIZE_MAX) {
+          size_t add = this->IsTerminal(symbol) ? 1 : min_lengths_[symbol];
+          length = add == SIZE_MAX ? SIZE_MAX : length + add;
+        }
+      }
+    }
+  }
+
+  void CreateClosures() {
+    IndexT max_ind = this->nonterminals_count_ + 1;
+    closures_.assign(max_ind + 1, Bitset(DottedCount()));
+    std::stack<uint32_t> stk;
+    for (IndexT left = this->kAuxiliaryStartSymbolInd; left <= max_ind;
+         ++left) {
+      Bitset& closure = closures_[left];
+      for (uint32_t dotted : predictions_[left]) {
+        stk.push(dotted);
+      }
+      while (!stk.empty()) {
+        uint32_t dotted = stk.top();
+        stk.pop();
+        if (closure.test(dotted)) {
+          continue;
+        }
+        closure.set(dotted);
+        IndexT symbol = NextSymbol(dotted);
+        if (!this->IsNonterminal(symbol)) {
+          continue;
+        }
+        for (uint32_t first : predictions_[symbol]) {
+          stk.push(first);
+        }
+        if (nullable_[symbol]) {
+          stk.push(dotted + 1);
+        }
+      }
+    }
+  }
+
+  // FIRST sets are bitsets over terminals (bit `-terminal - 1`)
+  void CreateStarters() {
+    size_t terminals_count = this->terminals_count_;
+    IndexT max_ind = this->nonterminals_count_ + 1;
+    Vector<Bitset> first(max_ind + 1, Bitset(terminals_count));
+    // FIRST of the rest of dotted rule, `begin` is the first dotted rule
+    auto rest_first = [this, &first](uint32_t begin, uint32_t end) {
+      Bitset res(first[0].size());
+      for (uint32_t dotted = end; dotted-- > begin;) {
+        IndexT symbol = dotted_symbol_[dotted];
+        if (this->IsTerminal(symbol)) {
+          res.reset().set(-symbol - 1);
+        } else if (this->IsNonterminal(symbol)) {
+          res = nullable_[symbol] ? res | first[symbol] : first[symbol];
+        }
+      }
+      return res;
+    };
+    bool change = true;
+    while (change) {
+      change = false;
+      for (IndexT left = this->kAuxiliaryStartSymbolInd; left <= max_ind;
+           ++left) {
+        for (uint32_t begin : predictions_[left]) {
+          Bitset rule_first = rest_first(begin, begin + RuleLength(begin));
+          if (!rule_first.is_subset_of(first[left])) {
+            first[left] |= rule_first;
+            change = true;
+          }
+        }
+      }
+    }
+    starters_.assign(terminals_count, Bitset(DottedCount()));
+    Bitset rest(terminals_count);
+    for (uint32_t dotted = uint32_t(DottedCount()); dotted-- > 0;) {
+      IndexT symbol = dotted_symbol_[dotted];
+      if (symbol == this->kEpsilonInd) {
+        rest.reset();
+      } else if (this->IsTerminal(symbol)) {
+        rest.reset().set(-symbol - 1);
+      } else {
+        rest = nullable_[symbol] ? rest | first[symbol] : first[symbol];
+      }
+      for (size_t ind = rest.find_first(); ind != Bitset::npos;
+           ind = rest.find_next(ind)) {
+        starters_[ind].set(dotted);
+      }
+    }
+  }
+
+  // number of symbols in the rule starting at dotted rule `begin`
+  uint32_t RuleLength(uint32_t begin) const {
+    uint32_t end = begin;
+    while (dotted_symbol_[end] != this->kEpsilonInd) {
+      ++end;
+    }
+    return end - begin;
+  }
+
+  // bit `d % 64` of word `d / 64` of the row stands for dotted rule `d`
+  void CreateBitRows() {
+    bit_words_ = std::bit_ceil((DottedCount() + 63) / 64);
+    if (bit_words_ > kMaxBitWords) {
+      bit_words_ = 0;
+      return;
+    }
+    size_t terminals_count = this->terminals_count_;
+    size_t max_ind = this->nonterminals_count_ + 1;
+    auto set_bit = [this](Vector<uint64_t>& rows, size_t row, size_t dotted) {
+      rows[row * bit_words_ + dotted / 64] |= uint64_t(1) << (dotted % 64);
+    };
+    waiting_rows_.assign((terminals_count + max_ind + 1) * bit_words_, 0);
+    predicting_row_.assign(bit_words_, 0);
+    nullable_next_row_.assign(bit_words_, 0);
+    for (size_t dotted = 0; dotted < DottedCount(); ++dotted) {
+      IndexT symbol = NextSymbol(uint32_t(dotted));
+      set_bit(waiting_rows_, size_t(symbol) + terminals_count, dotted);
+      if (this->IsNonterminal(symbol)) {
+        set_bit(predicting_row_, 0, dotted);
+        if (nullable_[symbol]) {
+          set_bit(nullable_next_row_, 0, dotted);
+        }
+      }
+    }
+    closure_rows_.assign((max_ind + 1) * bit_words_, 0);
+    for (size_t left = this->kAuxiliaryStartSymbolInd; left <= max_ind;
+         ++left) {
+      const Bitset& closure = closures_[left];
+      for (size_t dotted = closure.find_first(); dotted != Bitset::npos;
+           dotted = closure.find_next(dotted)) {
+        set_bit(closure_rows_, left, dotted);
+      }
+    }
+    starter_rows_.assign(terminals_count * bit_words_, 0);
+    for (size_t ind = 0; ind < terminals_count; ++ind) {
+      const Bitset& starters = starters_[ind];
+      for (size_t dotted = starters.find_first(); dotted != Bitset::npos;
+           dotted = starters.find_next(dotted)) {
+        set_bit(starter_rows_, ind, dotted);
+      }
+    }
+  }
+
+  void AfterClear() override {
+    start_eps_generating_symbols_.clear();
+    proc_eps_generating_symbols_.clear();
+    dotted_symbol_.clear();
+    dotted_left_.clear();
+    dotted_rule_.clear();
+    rule_begin_.clear();
+    class_rule_.clear();
+    source_rule_.clear();
+    predictions_.clear();
+    nullable_.clear();
+    min_lengths_.clear();
+    closures_.clear();
+    starters_.clear();
+    bit_words_ = 0;
+    waiting_rows_.clear();
+    closure_rows_.clear();
+    starter_rows_.clear();
+    predicting_row_.clear();
+    nullable_next_row_.clear();
+    automaton_.Clear();
+  }
+
+ private:
+  static constexpr size_t kMaxBitWords = 8;
+
+  USet<IndexT> start_eps_generating_symbols_;  // for printing source grammar
+  USet<IndexT> proc_eps_generating_symbols_;
+  Vector<IndexT> dotted_symbol_;
+  Vector<IndexT> dotted_left_;
+  Vector<uint32_t> dotted_rule_;
+  Vector<uint32_t> rule_begin_;           // first dotted rule, index is rule
+  Vector<uint32_t> class_rule_;           // index is rule of the grammar file
+  Vector<uint32_t> source_rule_;          // index is rule
+  Vector<Vector<uint32_t>> predictions_;  // index is nonterminal
+  Vector<bool> nullable_;                 // index is nonterminal
+  Vector<size_t> min_lengths_;            // index is nonterminal
+  Vector<Bitset> closures_;               // index is nonterminal
+  Vector<Bitset> starters_;               // index is -terminal - 1
+  size_t bit_words_ = 0;
+  Vector<uint64_t> waiting_rows_;  // index is symbol + terminals count
+  Vector<uint64_t> closure_rows_;  // index is nonterminal
+  Vector<uint64_t> starter_rows_;  // index is -terminal - 1
+  Vector<uint64_t> predicting_row_;
+  Vector<uint64_t> nullable_next_row_;
+  Automaton automaton_;
+};
+
+template <typename CharT>
+BasicEarleyParser<CharT>::BasicEarleyParser(const std::string& filename) {
+  EnterGrammar(filename);
+}
+
+template <typename CharT>
+BasicEarleyParser<CharT>::BasicEarleyParser(std::basic_istream<CharT>& input) {
+  EnterGrammar(input);
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::EnterGrammar(const std::string& filename) {
+  std::basic_ifstream<CharT> file(filename);
+  EnterGrammar(file);
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::EnterGrammar(std::basic_istream<CharT>& input) {
+  Clear();
+  grammar_.Read(input);
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::PrintGrammar(std::basic_ostream<CharT>& out) {
+  grammar_.Print(out);
+}
+
+template <typename CharT>
+bool BasicEarleyParser<CharT>::Parse(
+    const std::basic_string<CharT>& word) const {
+  Statistics stats;
+  return Parse(word, stats);
+}
+
+template <typename CharT>
+bool BasicEarleyParser<CharT>::Parse(const std::basic_string<CharT>& word,
+                                     Statistics& stats) const {
+  assert(("Grammar is not set for Earley parser", !grammar_.Empty()));
+  assert(("Word is too long", word.size() < UINT32_MAX));
+  stats = Statistics();
+  if (word.empty()) {
+    return grammar_.GenerateEpsilon();
+  }
+  Recognizer recognizer(*this);
+  recognizer.Feed(word);
+  stats = recognizer.Stats();
+  return recognizer.Finish();
+}
+
+template <typename CharT>
+bool BasicEarleyParser<CharT>::Parse(const std::basic_string<CharT>& word,
+                                     Forest& forest) const {
+  assert(("Grammar is not set for Earley parser", !grammar_.Empty()));
+  assert(("Word is too long", word.size() < UINT32_MAX));
+  return Trace<ForestBuilder>(word, forest);
+}
+
+template <typename CharT>
+bool BasicEarleyParser<CharT>::Parse(const std::basic_string<CharT>& word,
+                                     Tree& tree) const {
+  assert(("Grammar is not set for Earley parser", !grammar_.Empty()));
+  assert(("Word is too long", word.size() < UINT32_MAX));
+  return Trace<TreeBuilder>(word, tree);
+}
+
+// Words are walked in lexicographic order, so the trie of them is walked
+// depth first: chart is popped to the common prefix with the previous word
+// and advanced by the rest of the word.
+template <typename CharT>
+std::vector<bool> BasicEarleyParser<CharT>::ParseAll(
+    const std::vector<std::basic_string<CharT>>& words) const {
+  assert(("Grammar is not set for Earley parser", !grammar_.Empty()));
+  Vector<size_t> order(words.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::ranges::sort(order, [&words](size_t lhs, size_t rhs) {
+    return words[lhs] < words[rhs];
+  });
+  Options options = options_;
+  options.lookahead = false;
+  options.keep_sets = true;
+  Chart chart(grammar_, options);
+  chart.Start();
+  std::vector<bool> res(words.size());
+  const std::basic_string<CharT>* prev_word = nullptr;
+  for (size_t word_ind : order) {
+    const auto& word = words[word_ind];
+    assert(("Word is too long", word.size() < UINT32_MAX));
+    size_t common = 0;
+    if (prev_word != nullptr) {
+      common = std::ranges::mismatch(word, *prev_word).in1 - word.begin();
+    }
+    prev_word = &word;
+    while (chart.SetsCount() > common + 1) {
+      chart.Pop();
+    }
+    // the chart has died inside of the common prefix
+    if (chart.SetsCount() < common + 1) {
+      continue;
+    }
+    bool viable = true;
+    for (size_t ind = common; ind < word.size() && viable; ++ind) {
+      viable = chart.Advance(grammar_.ToInd(word[ind]));
+    }
+    res[word_ind] = word.empty() ? grammar_.GenerateEpsilon()
+                                 : viable && chart.Accepted();
+  }
+  return res;
+}
+
+// The start item is added to every set, so a completed start item with
+// origin `start` in the set `end` is a derivation of the span.
+template <typename CharT>
+void BasicEarleyParser<CharT>::FindAll(
+    const std::basic_string<CharT>& text,
+    const std::function<void(size_t, size_t)>& match, bool longest) const {
+  assert(("Grammar is not set for Earley parser", !grammar_.Empty()));
+  assert(("Text is too long", text.size() < UINT32_MAX));
+  Options options = options_;
+  options.all_spans = true;
+  Chart chart(grammar_, options);
+  chart.Start();
+  Vector<uint32_t> starts;
+  for (size_t ind = 0; ind < text.size(); ++ind) {
+    chart.Advance(grammar_.ToInd(text[ind]));
+    chart.SpanStarts(starts);
+    if (longest && !starts.empty()) {
+      starts.erase(starts.begin() + 1, starts.end());
+    }
+    for (uint32_t start : starts) {
+      match(start, ind + 1);
+    }
+  }
+}
+
+template <typename CharT>
+typename BasicEarleyParser<CharT>::SpanIndex BasicEarleyParser<CharT>::FindAll(
+    const std::basic_string<CharT>& text) const {
+  SpanIndex index;
+  FindAll(text, [&index](size_t start, size_t end) {
+    index.spans_.insert(SpanIndex::Key(start, end));
+  });
+  return index;
+}
+
+// Sets are positions of the lattice. Set is closed when all of the edges to
+// it are scanned, since edges go forward. Edges may skip positions, so sets
+// are kept.
+template <typename CharT>
+bool BasicEarleyParser<CharT>::Parse(std::span<const Edge> lattice,
+                                     size_t end) const {
+  assert(("Grammar is not set for Earley parser", !grammar_.Empty()));
+  assert(("Lattice is too long", end < UINT32_MAX));
+  if (end == 0) {
+    return grammar_.GenerateEpsilon();
+  }
+  Vector<Vector<const Edge*>> outgoing(end);
+  for (const Edge& edge : lattice) {
+    assert(("Edge goes back", edge.from < edge.to));
+    if (edge.to <= end) {
+      outgoing[edge.from].push_back(&edge);
+    }
+  }
+  Options options = options_;
+  options.lookahead = false;
+  options.keep_sets = true;
+  Chart chart(grammar_, options);
+  chart.Start();
+  Vector<Vector<Item>> pending(end + 1);
+  for (size_t pos = 0; pos < end; ++pos) {
+    if (pos > 0) {
+      chart.Push(std::move(pending[pos]));
+    }
+    chart.SealLast();
+    for (const Edge* edge : outgoing[pos]) {
+      chart.Scan(grammar_.ToInd(edge->symbol), pending[edge->to]);
+    }
+  }
+  chart.Push(std::move(pending[end]));
+  return chart.Accepted();
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::SetMode(Mode mode) {
+  options_.mode = mode;
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::SetLookahead(bool enabled) {
+  options_.lookahead = enabled;
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::SetBitParallel(bool enabled) {
+  options_.bit_parallel = enabled;
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::SetThreads(size_t count) {
+  options_.threads = std::max<size_t>(count, 1);
+}
+
+template <typename CharT>
+std::optional<size_t> BasicEarleyParser<CharT>::Distance(
+    const std::basic_string<CharT>& word, size_t max_errors) const {
+  assert(("Grammar is not set for Earley parser", !grammar_.Empty()));
+  // items are closed with the least errors, so one chart gives the minimum
+  ErrorChart chart(grammar_, max_errors);
+  chart.Start();
+  for (CharT symbol : word) {
+    if (!chart.Advance(grammar_.ToInd(symbol))) {
+      return std::nullopt;
+    }
+  }
+  return chart.Errors();
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::SetSpill(size_t resident_sets) {
+  options_.spill = resident_sets;
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::SetBeam(size_t width, Score score) {
+  options_.beam = width;
+  options_.score = std::move(score);
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::LoadRuleWeights(const std::string& filename) {
+  std::ifstream file(filename);
+  Vector<double> source_weights;
+  double weight = 0;
+  while (file >> weight) {
+    source_weights.push_back(weight);
+  }
+  if (!file.eof() || source_weights.size() != grammar_.SourceRulesCount()) {
+    std::wcerr << L"Expected " << grammar_.SourceRulesCount()
+               << L" weights of rules\n";
+    exit(ExitStatus::IncorrectGrammarInput);
+  }
+  Vector<double> weights(grammar_.RulesCount(),
+                         -std::numeric_limits<double>::infinity());
+  for (uint32_t rule = 0; rule < source_weights.size(); ++rule) {
+    double& class_weight = weights[grammar_.ClassRule(rule)];
+    class_weight = std::max(class_weight, source_weights[rule]);
+  }
+  options_.rule_weights =
+      std::make_shared<const Vector<double>>(std::move(weights));
+}
+
+template <typename CharT>
+template <class Builder, class Result>
+bool BasicEarleyParser<CharT>::Trace(const std::basic_string<CharT>& word,
+                                     Result& result) const {
+  Builder builder(grammar_, word, result);
+  TracedChart<Builder> chart(grammar_, builder);
+  chart.Start();
+  for (size_t ind = 0; ind < word.size(); ++ind) {
+    if (!chart.Advance(grammar_.ToInd(word[ind]))) {
+      break;
+    }
+  }
+  return chart.Finish();
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Clear() {
+  grammar_.Clear();
+}
+
+template <typename CharT>
+BasicEarleyParser<CharT>::Classifier::Classifier(
+    const std::vector<std::string>& filenames) {
+  Vector<Grammar> grammars(filenames.size());
+  for (size_t ind = 0; ind < filenames.size(); ++ind) {
+    std::basic_ifstream<CharT> file(filenames[ind]);
+    grammars[ind].Read(file);
+  }
+  starts_ = grammar_.Merge(grammars);
+  options_.start_rules = true;
+}
+
+template <typename CharT>
+std::vector<size_t> BasicEarleyParser<CharT>::Classifier::Parse(
+    const std::basic_string<CharT>& word) const {
+  assert(("Word is too long", word.size() < UINT32_MAX));
+  std::vector<size_t> res;
+  if (word.empty()) {
+    for (size_t ind = 0; ind < starts_.size(); ++ind) {
+      if (grammar_.GenerateEpsilon(starts_[ind])) {
+        res.push_back(ind);
+      }
+    }
+    return res;
+  }
+  Chart chart(grammar_, options_);
+  chart.Start();
+  for (CharT symbol : word) {
+    if (!chart.Advance(grammar_.ToInd(symbol))) {
+      return res;
+    }
+  }
+  Vector<IndexT> symbols;
+  chart.StartRules(symbols);
+  for (size_t ind = 0; ind < starts_.size(); ++ind) {
+    if (std::ranges::find(symbols, starts_[ind]) != symbols.end()) {
+      res.push_back(ind);
+    }
+  }
+  return res;
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Classifier::PrintGrammar(
+    std::basic_ostream<CharT>& out) const {
+  grammar_.Print(out);
+}
+
+template <typename CharT>
+BasicEarleyParser<CharT>::Recognizer::Recognizer(
+    const BasicEarleyParser& parser)
+    : grammar_(parser.grammar_),
+      options_(parser.options_),
+      chart_(std::in_place_type<Chart>, grammar_, options_) {
+  assert(("Grammar is not set for Earley parser", !grammar_.Empty()));
+  if (options_.beam != 0 || options_.spill != 0) {
+    // only the chart of items can drop or spill items
+  } else if (options_.mode == Mode::LR0Automaton) {
+    chart_.template emplace<AutomatonChart>(grammar_, options_);
+  } else if (options_.bit_parallel) {
+    switch (grammar_.BitWords()) {
+      case 1:
+        chart_.template emplace<BitChart<1>>(grammar_, options_);
+        break;
+      case 2:
+        chart_.template emplace<BitChart<2>>(grammar_, options_);
+        break;
+      case 4:
+        chart_.template emplace<BitChart<4>>(grammar_, options_);
+        break;
+      case 8:
+        chart_.template emplace<BitChart<8>>(grammar_, options_);
+        break;
+    }
+  }
+  std::visit([](auto& chart) { chart.Start(); }, chart_);
+}
+
+template <typename CharT>
+bool BasicEarleyParser<CharT>::Recognizer::Feed(
+    std::span<const CharT> symbols) {
+  if (!viable_) {
+    return false;
+  }
+  assert(("Word is too long", fed_ + symbols.size() < UINT32_MAX));
+  fed_ += symbols.size();
+  std::visit(
+      [this, symbols](auto& chart) {
+        for (size_t ind = 0; ind < symbols.size() && viable_; ++ind) {
+          viable_ = chart.Advance(grammar_.ToInd(symbols[ind]));
+        }
+      },
+      chart_);
+  return viable_;
+}
+
+template <typename CharT>
+bool BasicEarleyParser<CharT>::Recognizer::Finish() const {
+  if (fed_ == 0) {
+    return grammar_.GenerateEpsilon();
+  }
+  return viable_ &&
+         std::visit([](const auto& chart) { return chart.Accepted(); }, chart_);
+}
+
+template <typename CharT>
+const typename BasicEarleyParser<CharT>::Statistics&
+BasicEarleyParser<CharT>::Recognizer::Stats() const {
+  return std::visit(
+      [](const auto& chart) -> const Statistics& { return chart.Stats(); },
+      chart_);
+}
+
+template <typename CharT>
+BasicEarleyParser<CharT>::Document::Document(
+    const BasicEarleyParser& parser, const std::basic_string<CharT>& word)
+    : grammar_(parser.grammar_), chart_(grammar_, options_) {
+  options_.keep_sets = true;
+  chart_.Start();
+  Edit(0, 0, word);
+}
+
+template <typename CharT>
+bool BasicEarleyParser<CharT>::Document::Edit(
+    size_t offset, size_t deleted, const std::basic_string<CharT>& inserted) {
+  // throws std::out_of_range as basic_string::replace does
+  word_.replace(offset, deleted, inserted);
+  deleted = std::min(deleted, symbols_.size() - offset);
+  Vector<IndexT> symbols(inserted.size());
+  std::ranges::transform(inserted, symbols.begin(), [this](CharT symbol) {
+    return grammar_.ToInd(symbol);
+  });
+  symbols_.erase(symbols_.begin() + offset,
+                 symbols_.begin() + offset + deleted);
+  symbols_.insert(symbols_.begin() + offset, symbols.begin(), symbols.end());
+  // the chart may have died before the edit
+  size_t start = std::min(offset, chart_.SetsCount() - 1);
+  rebuilt_ = chart_.Reparse(symbols_, start, offset + inserted.size(),
+                            int64_t(inserted.size()) - int64_t(deleted));
+  return Accepted();
+}
+
+template <typename CharT>
+bool BasicEarleyParser<CharT>::Document::Accepted() const {
+  return chart_.SetsCount() == symbols_.size() + 1 && chart_.Accepted();
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::ErrorChart::Start() {
+  sets_.assign(1, {});
+  sets_[0].prefix_errors = 0;
+  predicted_.assign(grammar_.NonterminalsCount() + 2, SIZE_MAX);
+  buckets_.assign(max_errors_ + 1, {});
+  PredictRule(grammar_.StartDotted());
+}
+
+template <typename CharT>
+bool BasicEarleyParser<CharT>::ErrorChart::Advance(IndexT symbol) {
+  best_.clear();
+  const ErrorSet& last = sets_.back();
+  // deletion of the symbol
+  for (auto [item, errors] : last.items) {
+    Add(item, errors + 1);
+  }
+  // scan() with substitution of other terminals
+  for (const auto& [next, entries] : last.waiting) {
+    if (grammar_.IsTerminal(next)) {
+      for (auto [item, errors] : entries) {
+        Add(item.Next(), errors + (next == symbol ? 0 : 1));
+      }
+    }
+  }
+  sets_.emplace_back();
+  Close();
+  return !sets_.back().items.empty();
+}
+
+template <typename CharT>
+std::optional<size_t> BasicEarleyParser<CharT>::ErrorChart::Errors() const {
+  if (sets_.size() == 1) {
+    // completed items are not kept in the set of their origin
+    size_t errors = grammar_.MinLength(grammar_.kStartSymbolInd);
+    return errors <= max_errors_ ? std::optional(errors) : std::nullopt;
+  }
+  Item final_item(grammar_.FinalDotted(), 0);
+  for (auto [item, errors] : sets_.back().items) {
+    if (item == final_item) {
+      return errors;
+    }
+  }
+  return std::nullopt;
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::ErrorChart::Add(Item item, size_t errors) {
+  // origins of added items are before the set
+  if (errors + sets_[item.Origin()].prefix_errors > max_errors_) {
+    return;
+  }
+  auto [itr, inserted] = best_.try_emplace(item.Value(), errors, false);
+  if (!inserted) {
+    if (itr->second.second || itr->second.first <= errors) {
+      return;
+    }
+    itr->second.first = errors;
+  }
+  buckets_[errors].push_back(item);
+}
+
+// Items are never added to the buckets below the current one, since edits
+// only add errors.
+template <typename CharT>
+void BasicEarleyParser<CharT>::ErrorChart::Close() {
+  for (size_t errors = 0; errors <= max_errors_; ++errors) {
+    // items with the same errors are appended while the bucket is traversed
+    Vector<Item>& bucket = buckets_[errors];
+    for (size_t ind = 0; ind < bucket.size(); ++ind) {
+      Item item = bucket[ind];
+      auto& [best, closed] = best_[item.Value()];
+      if (closed || best != errors) {
+        continue;
+      }
+      closed = true;
+      Keep(item, errors);
+      size_t& prefix_errors = sets_.back().prefix_errors;
+      prefix_errors = std::min(
+          prefix_errors, errors + sets_[item.Origin()].prefix_errors);
+      uint32_t dotted = item.Dotted();
+      IndexT symbol = grammar_.NextSymbol(dotted);
+      if (grammar_.IsNonterminal(symbol)) {
+        Predict(symbol);
+        // the symbol derives the empty span by insertions only
+        if (grammar_.MinLength(symbol) <= max_errors_) {
+          Add(item.Next(), errors + grammar_.MinLength(symbol));
+        }
+      } else if (grammar_.IsTerminal(symbol)) {
+        Add(item.Next(), errors + 1);
+      } else {
+        // complete()
+        const auto& waiting = sets_[item.Origin()].waiting;
+        auto itr = waiting.find(grammar_.Left(dotted));
+        if (itr == waiting.end()) {
+          continue;
+        }
+        for (auto [parent, parent_errors] : itr->second) {
+          Add(parent.Next(), parent_errors + errors);
+        }
+      }
+    }
+    bucket.clear();
+  }
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::ErrorChart::Keep(Item item, size_t errors) {
+  ErrorSet& set = sets_.back();
+  set.items.emplace_back(item, errors);
+  IndexT symbol = grammar_.NextSymbol(item.Dotted());
+  if (symbol != grammar_.kEpsilonInd) {
+    set.waiting[symbol].emplace_back(item, errors);
+  }
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::ErrorChart::Predict(IndexT symbol) {
+  size_t set_ind = sets_.size() - 1;
+  if (predicted_[symbol] == set_ind) {
+    return;
+  }
+  predicted_[symbol] = set_ind;
+  for (uint32_t first : grammar_.Predictions(symbol)) {
+    PredictRule(first);
+  }
+}
+
+// Completed items are not kept, since nonterminals completed in the set of
+// their origin are skipped by MinLength().
+template <typename CharT>
+void BasicEarleyParser<CharT>::ErrorChart::PredictRule(uint32_t first) {
+  uint32_t origin = uint32_t(sets_.size() - 1);
+  size_t errors = 0;
+  for (uint32_t dotted = first; errors <= max_errors_; ++dotted) {
+    IndexT symbol = grammar_.NextSymbol(dotted);
+    if (symbol == grammar_.kEpsilonInd) {
+      break;
+    }
+    Keep(Item(dotted, origin), errors);
+    if (grammar_.IsNonterminal(symbol)) {
+      Predict(symbol);
+      if (grammar_.MinLength(symbol) > max_errors_) {
+        break;
+      }
+      errors += grammar_.MinLength(symbol);
+    } else {
+      ++errors;
+    }
+  }
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::Start() {
+  sets_.assign(1, {});
+  predicted_.assign(grammar_.NonterminalsCount() + 2, SIZE_MAX);
+  predicted_items_.resize(grammar_.DottedCount());
+  refs_.AddSet();
+  sets_[0].items.emplace_back(grammar_.StartDotted(), 0);
+  Close(0);
+}
+
+template <typename CharT>
+bool BasicEarleyParser<CharT>::Chart::Advance(IndexT symbol) {
+  bool terminal = grammar_.IsTerminal(symbol);
+  if (!terminal && !options_.all_spans) {
+    return false;
+  }
+  // the set is finished only now, when its lookahead is known;
+  // nothing goes on from it over a wrong symbol
+  if (terminal) {
+    AddPredicted(sets_.size() - 1, symbol);
+  } else {
+    predicted_items_.reset();
+  }
+  Seal(sets_.back());
+  // scan()
+  auto scanned =
+      terminal ? Range(sets_.back(), symbol) : std::span<const Item>();
+  if (scanned.empty() && !options_.all_spans) {
+    return false;
+  }
+  ChartSet next_set;
+  next_set.items.reserve(scanned.size() + 1);
+  for (Item item : scanned) {
+    next_set.items.push_back(item.Next());
+  }
+  if (options_.all_spans) {
+    next_set.items.emplace_back(grammar_.StartDotted(), uint32_t(sets_.size()));
+  }
+  sets_.push_back(std::move(next_set));
+  refs_.AddSet();
+  Close(sets_.size() - 1);
+  Retire(sets_.size() - 2);
+  if (options_.spill != 0 && !options_.keep_sets &&
+      sets_.size() > options_.spill) {
+    Spill(sets_.size() - 1 - options_.spill);
+  }
+  return true;
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::Scan(IndexT symbol,
+                                           Vector<Item>& items) const {
+  if (!grammar_.IsTerminal(symbol)) {
+    return;
+  }
+  for (Item item : Range(sets_.back(), symbol)) {
+    items.push_back(item.Next());
+  }
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::Push(Vector<Item> items) {
+  std::sort(items.begin(), items.end());
+  items.erase(std::unique(items.begin(), items.end()), items.end());
+  sets_.push_back({std::move(items), {}});
+  refs_.AddSet();
+  Close(sets_.size() - 1);
+  Retire(sets_.size() - 2);
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::StartRules(
+    Vector<IndexT>& symbols) const {
+  symbols.clear();
+  for (Item item : sets_.back().items) {
+    uint32_t dotted = item.Dotted();
+    if (grammar_.Left(dotted) == grammar_.kStartSymbolInd &&
+        grammar_.NextSymbol(dotted) == grammar_.kEpsilonInd &&
+        !grammar_.RuleStart(dotted) && item.Origin() == 0) {
+      symbols.push_back(grammar_.NextSymbol(dotted - 1));
+    }
+  }
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::SpanStarts(
+    Vector<uint32_t>& starts) const {
+  size_t set_ind = sets_.size() - 1;
+  starts.clear();
+  for (Item item : sets_.back().items) {
+    if (item.Dotted() == grammar_.FinalDotted() && item.Origin() != set_ind) {
+      starts.push_back(item.Origin());
+    }
+  }
+  std::ranges::sort(starts);
+}
+
+template <typename CharT>
+bool BasicEarleyParser<CharT>::Chart::Accepted() const {
+  Item final_item(grammar_.FinalDotted(), 0);
+  return std::ranges::find(sets_.back().items, final_item) !=
+         sets_.back().items.end();
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::Close(size_t set_ind) {
+  Vector<Item>& items = sets_[set_ind].items;
+  table_.Reset(items);
+  // `items` grows while being traversed, so it is indexed instead of iterated
+  for (size_t ind = 0; ind < items.size(); ++ind) {
+    if (options_.threads > 1 && items.size() >= kParallelItems) {
+      CloseParallel(set_ind, ind);
+      break;
+    }
+    Item item = items[ind];
+    IndexT symbol = grammar_.NextSymbol(item.Dotted());
+    if (grammar_.IsNonterminal(symbol)) {
+      if (grammar_.GenerateEpsilon(symbol)) {
+        table_.Insert(items, item.Next());
+      }
+      Predict(set_ind, symbol);
+    } else if (symbol == grammar_.kEpsilonInd && item.Origin() != set_ind) {
+      // items completed in the set of their origin are already handled
+      // by moving the dot over nullable symbols
+      Complete(set_ind, item);
+    }
+  }
+  if (options_.beam != 0 && items.size() > options_.beam) {
+    Prune(set_ind);
+  }
+  // predicted items are added later and refer to the set itself
+  for (Item item : items) {
+    refs_.Ref(set_ind, item.Origin());
+  }
+  refs_.AddItems(items.size());
+}
+
+// Predicted items are not counted, since their number is bounded by the
+// grammar. Items of the auxiliary rule are always kept.
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::Prune(size_t set_ind) {
+  Vector<Item>& items = sets_[set_ind].items;
+  Vector<std::pair<double, Item>> scored;
+  scored.reserve(items.size());
+  for (Item item : items) {
+    uint32_t dotted = item.Dotted();
+    size_t rule = grammar_.Rule(dotted);
+    double score = std::numeric_limits<double>::infinity();
+    if (rule != grammar_.kNoRule) {
+      size_t dot = grammar_.Dot(dotted);
+      size_t length = set_ind - item.Origin();
+      if (options_.score) {
+        score = options_.score(grammar_.SourceRule(rule), dot, length);
+      } else if (options_.rule_weights) {
+        score = (*options_.rule_weights)[rule];
+      } else {
+        score = 1;
+      }
+    }
+    scored.emplace_back(score, item);
+  }
+  // ties are broken by items, so the result doesn't depend on their order
+  auto better = [](const auto& lhs, const auto& rhs) {
+    return lhs.first > rhs.first ||
+           (lhs.first == rhs.first && lhs.second < rhs.second);
+  };
+  std::nth_element(scored.begin(), scored.begin() + options_.beam,
+                   scored.end(), better);
+  items.clear();
+  for (size_t ind = 0; ind < scored.size(); ++ind) {
+    if (ind < options_.beam || grammar_.Rule(scored[ind].second.Dotted()) ==
+                                   grammar_.kNoRule) {
+      items.push_back(scored[ind].second);
+    }
+  }
+  refs_.Prune();
+}
+
+// Items from `ind` on are processed in rounds. The round takes all of the
+// unprocessed items and finds what they add on this thread: Leo items, items
+// advanced over nullable symbols and ranges of items waiting for completed
+// symbols. Then waiting items are advanced on all threads. The closure
+// doesn't depend on the order of items, so the set is the same as after
+// Close() once it is sealed.
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::CloseParallel(size_t set_ind,
+                                                    size_t ind) {
+  if (!pool_) {
+    pool_ = std::make_unique<utl::ThreadPool>(options_.threads);
+    found_.resize(pool_->Size());
+  }
+  Vector<Item>& items = sets_[set_ind].items;
+  Vector<Item> direct;
+  Vector<std::span<const Item>> waiting;
+  Vector<size_t> waiting_ends;  // prefix sums of sizes of `waiting`
+  while (ind < items.size()) {
+    direct.clear();
+    waiting.clear();
+    waiting_ends.clear();
+    for (size_t end = items.size(); ind < end; ++ind) {
+      Item item = items[ind];
+      IndexT symbol = grammar_.NextSymbol(item.Dotted());
+      if (grammar_.IsNonterminal(symbol)) {
+        if (grammar_.GenerateEpsilon(symbol)) {
+          direct.push_back(item.Next());
+        }
+        Predict(set_ind, symbol);
+      } else if (symbol == grammar_.kEpsilonInd && item.Origin() != set_ind) {
+        IndexT left = grammar_.Left(item.Dotted());
+        if (auto top_item = Transitive(item.Origin(), left)) {
+          direct.push_back(*top_item);
+          continue;
+        }
+        waiting.push_back(Range(sets_[item.Origin()], left));
+        waiting_ends.push_back(
+            (waiting_ends.empty() ? 0 : waiting_ends.back()) +
+            waiting.back().size());
+      }
+    }
+    size_t waiting_count = waiting_ends.empty() ? 0 : waiting_ends.back();
+    shared_table_.Reset(items, items.size() + direct.size() + waiting_count);
+    for (Item item : direct) {
+      if (shared_table_.Insert(item)) {
+        items.push_back(item);
+      }
+    }
+    auto advance = [&](size_t begin, size_t end, size_t worker) {
+      size_t range_ind = std::ranges::upper_bound(waiting_ends, begin) -
+                         waiting_ends.begin();
+      for (size_t pos = begin; pos < end; ++pos) {
+        while (waiting_ends[range_ind] <= pos) {
+          ++range_ind;
+        }
+        size_t range_start = (range_ind == 0) ? 0 : waiting_ends[range_ind - 1];
+        Item item = waiting[range_ind][pos - range_start].Next();
+        if (shared_table_.Insert(item)) {
+          found_[worker].push_back(item);
+        }
+      }
+    };
+    if (waiting_count <= kParallelChunk) {
+      advance(0, waiting_count, 0);
+    } else {
+      pool_->ParallelFor(waiting_count, kParallelChunk, advance);
+    }
+    for (auto& found : found_) {
+      items.insert(items.end(), found.begin(), found.end());
+      found.clear();
+    }
+  }
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::Complete(size_t set_ind, Item item) {
+  IndexT left = grammar_.Left(item.Dotted());
+  // deterministic reduction path is followed in one step (Leo, 1991)
+  if (auto top_item = Transitive(item.Origin(), left)) {
+    table_.Insert(sets_[set_ind].items, *top_item);
+    return;
+  }
+  for (Item prev_item : Range(sets_[item.Origin()], left)) {
+    table_.Insert(sets_[set_ind].items, prev_item.Next());
+  }
+}
+
+// Returns the topmost completed item of the deterministic reduction path
+// started by completion of `symbol` with origin `set_ind`. The path goes on
+// while the set contains the only item waiting for the symbol and the symbol
+// is the last one in the rule of this item.
+template <typename CharT>
+std::optional<typename BasicEarleyParser<CharT>::Item>
+BasicEarleyParser<CharT>::Chart::Transitive(size_t set_ind, IndexT symbol) {
+  auto find = [this, set_ind, symbol]() {
+    auto& memo = sets_[set_ind].transitive;
+    return std::lower_bound(memo.begin(), memo.end(),
+                            std::pair(symbol, Item()));
+  };
+  auto iter = find();
+  if (iter != sets_[set_ind].transitive.end() && iter->first == symbol) {
+    return (iter->second == kNoItem) ? std::nullopt
+                                     : std::optional(iter->second);
+  }
+  // kNoItem also guards against cycles of unit rules during the recursion
+  sets_[set_ind].transitive.insert(iter, {symbol, kNoItem});
+  auto range = Range(sets_[set_ind], symbol);
+  if (range.size() != 1) {
+    return std::nullopt;
+  }
+  Item top_item = range[0].Next();
+  if (grammar_.NextSymbol(top_item.Dotted()) != grammar_.kEpsilonInd) {
+    return std::nullopt;
+  }
+  IndexT top_left = grammar_.Left(top_item.Dotted());
+  if (options_.start_rules && top_left == grammar_.kStartSymbolInd) {
+    // the rule tells which grammar derives the word
+  } else if (auto upper_item = Transitive(top_item.Origin(), top_left)) {
+    top_item = *upper_item;
+  }
+  find()->second = top_item;
+  refs_.Ref(set_ind, top_item.Origin());
+  return top_item;
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::Predict(size_t set_ind, IndexT symbol) {
+  if (predicted_[symbol] != set_ind) {
+    predicted_[symbol] = set_ind;
+    predicted_items_ |= grammar_.Closure(symbol);
+  }
+}
+
+// Predicted items are the only ones with origin in the current set, since
+// completions of their empty derivations are replaced by moving the dot over
+// nullable symbols. So they need neither deduplication nor processing, and
+// the ones that can't scan `lookahead` are useless.
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::AddPredicted(size_t set_ind,
+                                                   IndexT lookahead) {
+  if (options_.lookahead) {
+    predicted_items_ &= grammar_.Starters(lookahead);
+  }
+  size_t dotted = predicted_items_.find_first();
+  if (dotted == Bitset::npos) {
+    return;
+  }
+  Vector<Item>& items = sets_[set_ind].items;
+  size_t count = items.size();
+  for (; dotted != Bitset::npos; dotted = predicted_items_.find_next(dotted)) {
+    items.emplace_back(uint32_t(dotted), uint32_t(set_ind));
+  }
+  refs_.AddItems(items.size() - count);
+  predicted_items_.reset();
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::Seal(ChartSet& set) const {
+  std::sort(set.items.begin(), set.items.end(), [this](Item lhs, Item rhs) {
+    IndexT lhs_symbol = grammar_.NextSymbol(lhs.Dotted());
+    IndexT rhs_symbol = grammar_.NextSymbol(rhs.Dotted());
+    return lhs_symbol < rhs_symbol ||
+           (lhs_symbol == rhs_symbol && lhs.Value() < rhs.Value());
+  });
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::Retire(size_t set_ind) {
+  if (options_.keep_sets) {
+    return;
+  }
+  refs_.Retire(set_ind);
+  ReleaseUnused();
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::ReleaseUnused() {
+  while (auto released = refs_.PopReleased()) {
+    ChartSet& set = sets_[*released];
+    for (Item item : Items(set)) {
+      refs_.Unref(*released, item.Origin());
+    }
+    for (const auto& [symbol, item] : set.transitive) {
+      if (item != kNoItem) {
+        refs_.Unref(*released, item.Origin());
+      }
+    }
+    refs_.Release(set.items.size());
+    set = ChartSet();
+  }
+}
+
+// Sets that are not the last one are only looked up for items waiting for
+// nonterminals, so only these items are written, and references of the others
+// are dropped. They are sorted by the symbol after the dot and nonterminals
+// are positive, so they are the tail of the set.
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::Spill(size_t set_ind) {
+  ChartSet& set = sets_[set_ind];
+  if (set.items.empty()) {
+    // released
+    return;
+  }
+  if (!spill_) {
+    spill_ = std::make_unique<utl::SpillFile<Item>>();
+  }
+  auto waiting = std::ranges::partition_point(set.items, [this](Item item) {
+    return !grammar_.IsNonterminal(grammar_.NextSymbol(item.Dotted()));
+  });
+  set.spilled = spill_->Append({waiting, set.items.end()});
+  refs_.Spill(set.items.size(), size_t(set.items.end() - waiting));
+  for (auto iter = set.items.begin(); iter != waiting; ++iter) {
+    refs_.Unref(set_ind, iter->Origin());
+  }
+  Vector<Item>().swap(set.items);
+  ReleaseUnused();
+}
+
+template <typename CharT>
+std::span<const typename BasicEarleyParser<CharT>::Item>
+BasicEarleyParser<CharT>::Chart::Items(const ChartSet& set) const {
+  if (set.spilled != SIZE_MAX) {
+    return spill_->Get(set.spilled);
+  }
+  return set.items;
+}
+
+template <typename CharT>
+std::span<const typename BasicEarleyParser<CharT>::Item>
+BasicEarleyParser<CharT>::Chart::Range(const ChartSet& set,
+                                       IndexT symbol) const {
+  auto range = std::ranges::equal_range(
+      Items(set), symbol, {},
+      [this](Item item) { return grammar_.NextSymbol(item.Dotted()); });
+  return {range.begin(), range.end()};
+}
+
+// A set depends only on the word before it, so sets up to `start` stay.
+// The rebuilt set matches the old one if they agree on the items that are not
+// completed and the sets these items refer to are kept or match too, since
+// later sets look only at such items. Then the following old sets are the
+// same as the ones that would be rebuilt, as their items refer to the later
+// sets or to the sets referred by the matched one, directly or not. Set
+// `start` itself may match the old set after deleted symbols.
+template <typename CharT>
+size_t BasicEarleyParser<CharT>::Chart::Reparse(std::span<const IndexT> word,
+                                                size_t start,
+                                                size_t reuse_start,
+                                                int64_t delta) {
+  SealLast();
+  size_t old_first = start + 1;
+  Vector<ChartSet> old_sets(std::make_move_iterator(sets_.begin() + old_first),
+                            std::make_move_iterator(sets_.end()));
+  if (!old_sets.empty()) {
+    sets_.resize(old_first);
+    refs_.Truncate(old_first);
+    std::ranges::fill(predicted_, SIZE_MAX);
+  }
+  Vector<bool> matched;  // index is set - start
+  for (size_t set_ind = start; set_ind <= word.size(); ++set_ind) {
+    if (set_ind > start && !Advance(word[set_ind - 1])) {
+      break;
+    }
+    matched.push_back(false);
+    int64_t old_ind = int64_t(set_ind) - delta;
+    if (set_ind < reuse_start || old_ind < int64_t(old_first) ||
+        old_ind >= int64_t(old_first + old_sets.size())) {
+      continue;
+    }
+    SealLast();
+    if (!Matches(set_ind, old_sets[old_ind - old_first], start, matched,
+                 delta)) {
+      continue;
+    }
+    // old origins from `shifted` on are the matched sets and the later ones
+    size_t shifted = std::max(size_t(int64_t(reuse_start) - delta), old_first);
+    for (size_t old = old_ind + 1 - old_first; old < old_sets.size(); ++old) {
+      Shift(old_sets[old], shifted, delta);
+      sets_.push_back(std::move(old_sets[old]));
+      refs_.AddSet();
+    }
+    break;
+  }
+  return matched.size() - 1;
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::Pop() {
+  size_t set_ind = sets_.size() - 1;
+  // the next set with this index must predict again
+  std::ranges::replace(predicted_, set_ind, SIZE_MAX);
+  predicted_items_.reset();
+  sets_.pop_back();
+  refs_.Truncate(set_ind);
+}
+
+// adds pending predicted items, so the last set can be compared or kept
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::SealLast() {
+  AddPredicted(sets_.size() - 1, grammar_.kEpsilonInd);
+  Seal(sets_.back());
+}
+
+// Both sets are sealed and origins are mapped monotonically, so the items
+// are compared in order.
+template <typename CharT>
+bool BasicEarleyParser<CharT>::Chart::Matches(size_t set_ind,
+                                              const ChartSet& old_set,
+                                              size_t start,
+                                              const Vector<bool>& matched,
+                                              int64_t delta) const {
+  auto not_completed = [this](Item item) {
+    return grammar_.NextSymbol(item.Dotted()) != grammar_.kEpsilonInd;
+  };
+  auto items = sets_[set_ind].items | std::views::filter(not_completed);
+  auto old_items = old_set.items | std::views::filter(not_completed);
+  auto old_iter = old_items.begin();
+  for (Item item : items) {
+    if (old_iter == old_items.end()) {
+      return false;
+    }
+    uint32_t origin = item.Origin();
+    if (origin >= start) {
+      bool mapped = (origin == set_ind) || matched[origin - start];
+      if (!mapped && origin > start) {
+        return false;
+      }
+      if (mapped) {
+        origin = uint32_t(int64_t(origin) - delta);
+      }
+    }
+    if (*old_iter != Item(item.Dotted(), origin)) {
+      return false;
+    }
+    ++old_iter;
+  }
+  return old_iter == old_items.end();
+}
+
+// moves origins from `from` on by `delta`
+template <typename CharT>
+void BasicEarleyParser<CharT>::Chart::Shift(ChartSet& set, size_t from,
+                                            int64_t delta) const {
+  auto shift = [from, delta](Item item) {
+    if (item == kNoItem || item.Origin() < from) {
+      return item;
+    }
+    return Item(item.Dotted(), uint32_t(int64_t(item.Origin()) + delta));
+  };
+  std::ranges::transform(set.items, set.items.begin(), shift);
+  for (auto& [symbol, item] : set.transitive) {
+    item = shift(item);
+  }
+}
+
+template <typename CharT>
+template <size_t Words>
+void BasicEarleyParser<CharT>::BitChart<Words>::Start() {
+  sets_.assign(1, {});
+  row_ind_.assign(1, 0);
+  predicted_.assign(grammar_.NonterminalsCount() + 2, SIZE_MAX);
+  pending_.clear();
+  refs_.AddSet();
+  Row row{};
+  uint32_t start = grammar_.StartDotted();
+  row[start / 64] |= uint64_t(1) << (start % 64);
+  Add(0, 0, row);
+  Close(0);
+}
+
+template <typename CharT>
+template <size_t Words>
+bool BasicEarleyParser<CharT>::BitChart<Words>::Advance(IndexT symbol) {
+  if (!grammar_.IsTerminal(symbol)) {
+    return false;
+  }
+  size_t set_ind = sets_.size() - 1;
+  if (options_.lookahead) {
+    const uint64_t* starters = grammar_.StartersRow(symbol);
+    for (size_t word = 0; word < Words; ++word) {
+      sets_[set_ind].predicted[word] &= starters[word];
+    }
+  }
+  refs_.AddItems(Count(sets_[set_ind].predicted));
+  // scan()
+  sets_.emplace_back();
+  refs_.AddSet();
+  row_ind_.push_back(0);
+  pending_.clear();
+  const RowSet& set = sets_[set_ind];
+  const uint64_t* waiting = grammar_.WaitingRow(symbol);
+  for (const auto& [origin, items] : set.rows) {
+    Row row = Advanced(items, waiting);
+    if (!Empty(row)) {
+      Add(set_ind + 1, origin, row);
+    }
+  }
+  Row row = Advanced(set.predicted, waiting);
+  if (!Empty(row)) {
+    Add(set_ind + 1, set_ind, row);
+  }
+  if (sets_.back().rows.empty()) {
+    return false;
+  }
+  Close(set_ind + 1);
+  Retire(set_ind);
+  return true;
+}
+
+template <typename CharT>
+template <size_t Words>
+bool BasicEarleyParser<CharT>::BitChart<Words>::Accepted() const {
+  const RowSet& set = sets_.back();
+  uint32_t final_dotted = grammar_.FinalDotted();
+  for (const auto& [origin, items] : set.rows) {
+    if (origin == 0 && (items[final_dotted / 64] >> (final_dotted % 64)) & 1) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename CharT>
+template <size_t Words>
+void BasicEarleyParser<CharT>::BitChart<Words>::Close(size_t set_ind) {
+  RowSet& set = sets_[set_ind];
+  while (!queue_.empty()) {
+    uint32_t ind = queue_.back();
+    queue_.pop_back();
+    Row row = std::exchange(pending_[ind], Row{});
+    size_t origin = set.rows[ind].first;
+    Row skipped = Advanced(row, grammar_.NullableNextRow());
+    if (!Empty(skipped)) {
+      Add(set_ind, origin, skipped);
+    }
+    ForEach(row, grammar_.PredictingRow(),
+            [this, set_ind, &set](size_t dotted) {
+              IndexT symbol = grammar_.NextSymbol(uint32_t(dotted));
+              if (predicted_[symbol] != set_ind) {
+                predicted_[symbol] = set_ind;
+                const uint64_t* closure = grammar_.ClosureRow(symbol);
+                for (size_t word = 0; word < Words; ++word) {
+                  set.predicted[word] |= closure[word];
+                }
+              }
+            });
+    // origin of rows is never the set itself, see RowSet; rules of one
+    // nonterminal are adjacent, so it is completed once per row
+    IndexT prev_left = grammar_.kEpsilonInd;
+    ForEach(row, grammar_.WaitingRow(grammar_.kEpsilonInd),
+            [this, set_ind, origin, &prev_left](size_t dotted) {
+              IndexT left = grammar_.Left(uint32_t(dotted));
+              if (left != prev_left) {
+                prev_left = left;
+                Complete(set_ind, origin, left);
+              }
+            });
+  }
+  // predicted items refer to the set itself
+  for (const auto& [origin, items] : set.rows) {
+    refs_.Ref(set_ind, origin);
+    refs_.AddItems(Count(items));
+  }
+}
+
+template <typename CharT>
+template <size_t Words>
+void BasicEarleyParser<CharT>::BitChart<Words>::Complete(size_t set_ind,
+                                                         size_t origin,
+                                                         IndexT symbol) {
+  if (auto top_item = Transitive(origin, symbol)) {
+    Row row{};
+    row[top_item->Dotted() / 64] |= uint64_t(1) << (top_item->Dotted() % 64);
+    Add(set_ind, top_item->Origin(), row);
+    return;
+  }
+  const RowSet& set = sets_[origin];
+  const uint64_t* waiting = grammar_.WaitingRow(symbol);
+  for (const auto& [row_origin, items] : set.rows) {
+    Row row = Advanced(items, waiting);
+    if (!Empty(row)) {
+      Add(set_ind, row_origin, row);
+    }
+  }
+  Row row = Advanced(set.predicted, waiting);
+  if (!Empty(row)) {
+    Add(set_ind, origin, row);
+  }
+}
+
+// Same as Chart::Transitive(), items waiting for the symbol are counted
+// over the rows.
+template <typename CharT>
+template <size_t Words>
+std::optional<typename BasicEarleyParser<CharT>::Item>
+BasicEarleyParser<CharT>::BitChart<Words>::Transitive(size_t set_ind,
+                                                      IndexT symbol) {
+  auto find = [this, set_ind, symbol]() {
+    auto& memo = sets_[set_ind].transitive;
+    return std::lower_bound(memo.begin(), memo.end(),
+                            std::pair(symbol, Item()));
+  };
+  auto iter = find();
+  if (iter != sets_[set_ind].transitive.end() && iter->first == symbol) {
+    return (iter->second == kNoItem) ? std::nullopt
+                                     : std::optional(iter->second);
+  }
+  sets_[set_ind].transitive.insert(iter, {symbol, kNoItem});
+  const RowSet& set = sets_[set_ind];
+  const uint64_t* waiting = grammar_.WaitingRow(symbol);
+  size_t count = 0;
+  Item waiting_item;
+  auto count_row = [waiting, &count, &waiting_item](const Row& row,
+                                                     size_t origin) {
+    for (size_t word = 0; word < Words && count <= 1; ++word) {
+      uint64_t bits = row[word] & waiting[word];
+      if (bits != 0) {
+        count += std::popcount(bits);
+        waiting_item =
+            Item(uint32_t(word * 64 + std::countr_zero(bits)), origin);
+      }
+    }
+  };
+  count_row(set.predicted, set_ind);
+  for (size_t ind = 0; ind < set.rows.size() && count <= 1; ++ind) {
+    count_row(set.rows[ind].second, set.rows[ind].first);
+  }
+  if (count != 1) {
+    return std::nullopt;
+  }
+  Item top_item = waiting_item.Next();
+  if (grammar_.NextSymbol(top_item.Dotted()) != grammar_.kEpsilonInd) {
+    return std::nullopt;
+  }
+  if (auto upper_item =
+          Transitive(top_item.Origin(), grammar_.Left(top_item.Dotted()))) {
+    top_item = *upper_item;
+  }
+  find()->second = top_item;
+  refs_.Ref(set_ind, top_item.Origin());
+  return top_item;
+}
+
+// adds items of `row` with `origin` to the set, new ones become pending
+template <typename CharT>
+template <size_t Words>
+void BasicEarleyParser<CharT>::BitChart<Words>::Add(size_t set_ind,
+                                                    size_t origin,
+                                                    const Row& row) {
+  RowSet& set = sets_[set_ind];
+  uint32_t& ind = row_ind_[origin];
+  if (ind >= set.rows.size() || set.rows[ind].first != origin) {
+    ind = uint32_t(set.rows.size());
+    set.rows.emplace_back(uint32_t(origin), Row{});
+    pending_.emplace_back();
+  }
+  Row& dest = set.rows[ind].second;
+  Row& pending = pending_[ind];
+  bool queued = !Empty(pending);
+  bool added = false;
+  for (size_t word = 0; word < Words; ++word) {
+    uint64_t bits = row[word] & ~dest[word];
+    dest[word] |= bits;
+    pending[word] |= bits;
+    added |= (bits != 0);
+  }
+  if (added && !queued) {
+    queue_.push_back(ind);
+  }
+}
+
+template <typename CharT>
+template <size_t Words>
+void BasicEarleyParser<CharT>::BitChart<Words>::Retire(size_t set_ind) {
+  refs_.Retire(set_ind);
+  while (auto released = refs_.PopReleased()) {
+    RowSet& set = sets_[*released];
+    size_t count = Count(set.predicted);
+    for (const auto& [origin, items] : set.rows) {
+      refs_.Unref(*released, origin);
+      count += Count(items);
+    }
+    for (const auto& [symbol, item] : set.transitive) {
+      if (item != kNoItem) {
+        refs_.Unref(*released, item.Origin());
+      }
+    }
+    refs_.Release(count);
+    set = RowSet();
+  }
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Forest::Clear() {
+  nodes_.clear();
+  packed_.clear();
+  first_packed_.clear();
+  packed_nodes_.clear();
+  root_ = kNoNode;
+}
+
+template <typename CharT>
+uint32_t BasicEarleyParser<CharT>::Forest::AddNode(IndexT symbol,
+                                                   bool intermediate,
+                                                   size_t start, size_t end) {
+  nodes_.push_back({symbol, intermediate, uint32_t(start), uint32_t(end)});
+  return uint32_t(nodes_.size() - 1);
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Forest::AddPacked(uint32_t node, uint32_t left,
+                                                 uint32_t right) {
+  packed_nodes_.push_back(node);
+  packed_.push_back({left, right});
+}
+
+// groups packed nodes by their parents, duplicates are removed
+template <typename CharT>
+void BasicEarleyParser<CharT>::Forest::Seal(uint32_t root) {
+  root_ = root;
+  first_packed_.assign(nodes_.size() + 1, 0);
+  for (uint32_t node : packed_nodes_) {
+    ++first_packed_[node + 1];
+  }
+  for (size_t node = 0; node < nodes_.size(); ++node) {
+    first_packed_[node + 1] += first_packed_[node];
+  }
+  Vector<Packed> grouped(packed_.size());
+  Vector<uint32_t> next(first_packed_.begin(), first_packed_.end() - 1);
+  for (size_t ind = 0; ind < packed_.size(); ++ind) {
+    grouped[next[packed_nodes_[ind]]++] = packed_[ind];
+  }
+  packed_.clear();
+  for (size_t node = 0; node < nodes_.size(); ++node) {
+    auto begin = grouped.begin() + first_packed_[node];
+    auto end = grouped.begin() + first_packed_[node + 1];
+    std::sort(begin, end);
+    first_packed_[node] = uint32_t(packed_.size());
+    std::unique_copy(begin, end, std::back_inserter(packed_));
+  }
+  first_packed_.back() = uint32_t(packed_.size());
+  packed_nodes_.clear();
+  packed_nodes_.shrink_to_fit();
+}
+
+template <typename CharT>
+template <class Builder>
+void BasicEarleyParser<CharT>::TracedChart<Builder>::Start() {
+  rejected_ = false;
+  sets_.clear();
+  predicted_.assign(grammar_.NonterminalsCount() + 2, SIZE_MAX);
+  items_.assign(1, Item(grammar_.StartDotted(), 0));
+  values_.assign(1, Builder::kNone);
+  table_.Reset(items_);
+  Close(0);
+}
+
+template <typename CharT>
+template <class Builder>
+bool BasicEarleyParser<CharT>::TracedChart<Builder>::Advance(IndexT symbol) {
+  Seal();
+  size_t set_ind = sets_.size();
+  auto scanned = grammar_.IsTerminal(symbol) ? Range(set_ind - 1, symbol)
+                                             : decltype(Range(0, 0))();
+  if (scanned.empty()) {
+    rejected_ = true;
+    return false;
+  }
+  uint32_t terminal = builder_.Terminal(set_ind, symbol);
+  for (const auto& [item, value] : scanned) {
+    Add(set_ind, item.Next(), value, terminal);
+  }
+  Close(set_ind);
+  return true;
+}
+
+template <typename CharT>
+template <class Builder>
+bool BasicEarleyParser<CharT>::TracedChart<Builder>::Finish() {
+  std::optional<uint32_t> accepting;
+  auto iter = std::ranges::find(items_, Item(grammar_.FinalDotted(), 0));
+  if (!rejected_ && iter != items_.end()) {
+    accepting = values_[iter - items_.begin()];
+  }
+  return builder_.Finish(sets_.size(), accepting);
+}
+
+template <typename CharT>
+template <class Builder>
+void BasicEarleyParser<CharT>::TracedChart<Builder>::Close(size_t set_ind) {
+  for (size_t ind = 0; ind < items_.size(); ++ind) {
+    Item item = items_[ind];
+    uint32_t value = values_[ind];
+    IndexT symbol = grammar_.NextSymbol(item.Dotted());
+    if (grammar_.IsNonterminal(symbol)) {
+      if (predicted_[symbol] != set_ind) {
+        predicted_[symbol] = set_ind;
+        for (uint32_t dotted : grammar_.Predictions(symbol)) {
+          if (table_.Insert(items_, Item(dotted, uint32_t(set_ind)))) {
+            values_.push_back(Builder::kNone);
+          }
+        }
+      }
+      if (grammar_.GenerateEpsilon(symbol)) {
+        Add(set_ind, item.Next(), value, builder_.Empty(set_ind, symbol));
+      }
+    } else if (symbol == grammar_.kEpsilonInd && item.Origin() != set_ind) {
+      IndexT left = grammar_.Left(item.Dotted());
+      for (const auto& [prev_item, prev_value] : Range(item.Origin(), left)) {
+        Add(set_ind, prev_item.Next(), prev_value, value);
+      }
+    }
+  }
+}
+
+template <typename CharT>
+template <class Builder>
+void BasicEarleyParser<CharT>::TracedChart<Builder>::Add(size_t set_ind,
+                                                         Item item,
+                                                         uint32_t prev,
+                                                         uint32_t symbol) {
+  if constexpr (Builder::kAllDerivations) {
+    uint32_t value = builder_.Derive(set_ind, item, prev, symbol);
+    if (table_.Insert(items_, item)) {
+      values_.push_back(value);
+    }
+  } else if (table_.Insert(items_, item)) {
+    values_.push_back(builder_.Derive(set_ind, item, prev, symbol));
+  }
+}
+
+template <typename CharT>
+template <class Builder>
+void BasicEarleyParser<CharT>::TracedChart<Builder>::Seal() {
+  Vector<std::pair<Item, uint32_t>> set(items_.size());
+  for (size_t ind = 0; ind < items_.size(); ++ind) {
+    set[ind] = {items_[ind], values_[ind]};
+  }
+  std::sort(set.begin(), set.end(), [this](const auto& lhs, const auto& rhs) {
+    IndexT lhs_symbol = grammar_.NextSymbol(lhs.first.Dotted());
+    IndexT rhs_symbol = grammar_.NextSymbol(rhs.first.Dotted());
+    return lhs_symbol < rhs_symbol ||
+           (lhs_symbol == rhs_symbol && lhs.first < rhs.first);
+  });
+  sets_.push_back(std::move(set));
+  items_.clear();
+  values_.clear();
+  table_.Reset(items_);
+  builder_.NextSet();
+}
+
+template <typename CharT>
+template <class Builder>
+std::span<const std::pair<typename BasicEarleyParser<CharT>::Item, uint32_t>>
+BasicEarleyParser<CharT>::TracedChart<Builder>::Range(size_t set_ind,
+                                                      IndexT symbol) const {
+  auto range = std::ranges::equal_range(
+      sets_[set_ind], symbol, {}, [this](const auto& pair) {
+        return grammar_.NextSymbol(pair.first.Dotted());
+      });
+  return {range.begin(), range.end()};
+}
+
+template <typename CharT>
+BasicEarleyParser<CharT>::ForestBuilder::ForestBuilder(const Grammar& grammar,
+                                                       const String& word,
+                                                       Forest& forest)
+    : grammar_(grammar), word_(word), forest_(forest) {
+  forest_.Clear();
+  forest_.names_.Assign(grammar);
+}
+
+template <typename CharT>
+uint32_t BasicEarleyParser<CharT>::ForestBuilder::Terminal(size_t set_ind,
+                                                           IndexT /*symbol*/) {
+  return forest_.AddNode(grammar_.TerminalInd(word_[set_ind - 1]), false,
+                         set_ind - 1, set_ind);
+}
+
+template <typename CharT>
+uint32_t BasicEarleyParser<CharT>::ForestBuilder::Empty(size_t set_ind,
+                                                        IndexT symbol) {
+  return SymbolNode(set_ind, symbol, set_ind);
+}
+
+// Returns the node of `item` which is derived by `prev` node of the item with
+// the dot moved back and `symbol` node of the symbol before the dot.
+template <typename CharT>
+uint32_t BasicEarleyParser<CharT>::ForestBuilder::Derive(size_t set_ind,
+                                                         Item item,
+                                                         uint32_t prev,
+                                                         uint32_t symbol) {
+  uint32_t dotted = item.Dotted();
+  bool first = grammar_.RuleStart(dotted - 1);
+  bool completed = grammar_.NextSymbol(dotted) == grammar_.kEpsilonInd;
+  if (first && !completed) {
+    return symbol;
+  }
+  if (completed && item.Origin() == set_ind) {
+    return kNone;  // the symbol gets node without children
+  }
+  IndexT left = grammar_.Left(dotted);
+  uint32_t node = kNone;
+  if (completed) {
+    node = SymbolNode(set_ind, left, item.Origin());
+  } else {
+    auto [iter, inserted] = labels_.insert({item.Value(), 0});
+    if (inserted) {
+      iter->second = forest_.AddNode(left, true, item.Origin(), set_ind);
+    }
+    node = iter->second;
+  }
+  forest_.AddPacked(node, first ? kNone : prev, symbol);
+  return node;
+}
+
+template <typename CharT>
+bool BasicEarleyParser<CharT>::ForestBuilder::Finish(
+    size_t set_ind, std::optional<uint32_t> accepting) {
+  uint32_t root = kNone;
+  if (accepting) {
+    root = SymbolNode(set_ind, grammar_.kStartSymbolInd, 0);
+  }
+  forest_.Seal(root);
+  return root != kNone;
+}
+
+template <typename CharT>
+uint32_t BasicEarleyParser<CharT>::ForestBuilder::SymbolNode(size_t set_ind,
+                                                             IndexT symbol,
+                                                             size_t start) {
+  auto [iter, inserted] =
+      labels_.insert({kSymbolKey | uint64_t(symbol) << 32 | start, 0});
+  if (inserted) {
+    iter->second = forest_.AddNode(symbol, false, start, set_ind);
+  }
+  return iter->second;
+}
+
+template <typename CharT>
+BasicEarleyParser<CharT>::TreeBuilder::TreeBuilder(const Grammar& grammar,
+                                                   const String& word,
+                                                   Tree& tree)
+    : grammar_(grammar), word_(word), tree_(tree) {
+  tree_.nodes_.clear();
+  tree_.children_.clear();
+  tree_.first_child_.assign(1, 0);
+  tree_.names_.Assign(grammar);
+  tree_.root_ = Tree::kNoNode;
+}
+
+// Walks the links back from the accepting item. Children of a node are
+// restored from right to left, so the span of each child ends where the
+// next one starts.
+template <typename CharT>
+bool BasicEarleyParser<CharT>::TreeBuilder::Finish(
+    size_t set_ind, std::optional<uint32_t> accepting) {
+  if (!accepting) {
+    return false;
+  }
+  struct Frame {
+    uint32_t node;
+    uint32_t link;
+    uint32_t child;  // slot of the next child to restore
+    size_t end;      // end of the next child
+  };
+  uint32_t start = links_[*accepting].symbol;
+  if (start == kEmpty) {
+    tree_.root_ = AddNode(grammar_.kStartSymbolInd, set_ind, kNone);
+    return true;
+  }
+  std::stack<Frame> stk;
+  auto push = [this, &stk](IndexT symbol, size_t end, uint32_t link) {
+    uint32_t node = AddNode(symbol, end, link);
+    stk.push({node, link, tree_.first_child_[node + 1], end});
+    return node;
+  };
+  tree_.root_ = push(grammar_.kStartSymbolInd, set_ind, start);
+  while (!stk.empty()) {
+    Frame& frame = stk.top();
+    if (frame.link == kNone) {
+      tree_.nodes_[frame.node].start = uint32_t(frame.end);
+      uint32_t node = frame.node;
+      stk.pop();
+      if (!stk.empty()) {
+        stk.top().end = tree_.nodes_[node].start;
+      }
+      continue;
+    }
+    const Link& link = links_[frame.link];
+    IndexT symbol = grammar_.NextSymbol(link.dotted - 1);
+    uint32_t child = --frame.child;
+    frame.link = link.prev;
+    if (link.symbol == kTerminal) {
+      symbol = grammar_.TerminalInd(word_[frame.end - 1]);
+      tree_.children_[child] = AddNode(symbol, frame.end, kNone);
+      tree_.nodes_[tree_.children_[child]].start = uint32_t(--frame.end);
+    } else if (link.symbol == kEmpty) {
+      tree_.children_[child] = AddNode(symbol, frame.end, kNone);
+    } else {
+      // `frame` is invalidated by push
+      tree_.children_[child] = push(symbol, frame.end, link.symbol);
+    }
+  }
+  return true;
+}
+
+// adds node with slots for the children of the item of `link`
+template <typename CharT>
+uint32_t BasicEarleyParser<CharT>::TreeBuilder::AddNode(IndexT symbol,
+                                                        size_t end,
+                                                        uint32_t link) {
+  size_t children_count = 0;
+  if (link != kNone) {
+    for (uint32_t dotted = links_[link].dotted; !grammar_.RuleStart(dotted);
+         --dotted) {
+      ++children_count;
+    }
+  }
+  tree_.nodes_.push_back({symbol, uint32_t(end), uint32_t(end)});
+  tree_.children_.resize(tree_.children_.size() + children_count);
+  tree_.first_child_.push_back(uint32_t(tree_.children_.size()));
+  return uint32_t(tree_.nodes_.size() - 1);
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Automaton::Build(const Grammar& grammar) {
+  Clear();
+  terminals_count_ = grammar.TerminalsCount();
+  width_ = size_t(terminals_count_ + grammar.NonterminalsCount() + 2);
+  std::map<Vector<uint32_t>, uint32_t> ids;
+  Vector<Vector<uint32_t>> states;
+  auto add_state = [&ids, &states](Vector<uint32_t> items) -> uint32_t {
+    if (items.empty()) {
+      return kNoState;
+    }
+    auto res = ids.insert({items, uint32_t(states.size())});
+    if (res.second) {
+      states.push_back(std::move(items));
+    }
+    return res.first->second;
+  };
+  add_state(Kernel(grammar, {grammar.StartDotted()}));
+  // `states` grows while being traversed
+  for (size_t state = 0; state < states.size(); ++state) {
+    Vector<uint32_t> items = states[state];
+    Vector<uint32_t> predicted = Predicted(grammar, items);
+    bool is_new = !std::includes(items.begin(), items.end(),
+                                 predicted.begin(), predicted.end());
+    epsilon_goto_.push_back(is_new ? add_state(std::move(predicted))
+                                   : kNoState);
+    accepting_.push_back(std::binary_search(items.begin(), items.end(),
+                                            grammar.FinalDotted()));
+    completed_.emplace_back();
+    waiting_.emplace_back();
+    std::map<IndexT, Vector<uint32_t>> moves;
+    for (uint32_t dotted : items) {
+      IndexT symbol = grammar.NextSymbol(dotted);
+      if (symbol != grammar.kEpsilonInd) {
+        moves[symbol].push_back(dotted + 1);
+      } else if (std::find(completed_[state].begin(), completed_[state].end(),
+                           grammar.Left(dotted)) == completed_[state].end()) {
+        completed_[state].push_back(grammar.Left(dotted));
+      }
+    }
+    goto_.resize((state + 1) * width_, kNoState);
+    for (auto& [symbol, next_items] : moves) {
+      uint32_t next_state = add_state(Kernel(grammar, std::move(next_items)));
+      goto_[state * width_ + size_t(symbol + terminals_count_)] = next_state;
+      if (grammar.IsNonterminal(symbol)) {
+        waiting_[state].push_back(symbol);
+      }
+    }
+  }
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::Automaton::Clear() {
+  terminals_count_ = 0;
+  width_ = 0;
+  goto_.clear();
+  epsilon_goto_.clear();
+  completed_.clear();
+  waiting_.clear();
+  accepting_.clear();
+}
+
+// adds items reachable by moving the dot over nullable symbols
+template <typename CharT>
+BasicEarleyParser<CharT>::Vector<uint32_t>
+BasicEarleyParser<CharT>::Automaton::Kernel(const Grammar& grammar,
+                                            Vector<uint32_t> items) {
+  for (size_t ind = 0; ind < items.size(); ++ind) {
+    IndexT symbol = grammar.NextSymbol(items[ind]);
+    if (grammar.IsNonterminal(symbol) && grammar.GenerateEpsilon(symbol) &&
+        std::find(items.begin(), items.end(), items[ind] + 1) == items.end()) {
+      items.push_back(items[ind] + 1);
+    }
+  }
+  std::sort(items.begin(), items.end());
+  return items;
+}
+
+// returns all items predicted by `items`
+template <typename CharT>
+BasicEarleyParser<CharT>::Vector<uint32_t>
+BasicEarleyParser<CharT>::Automaton::Predicted(const Grammar& grammar,
+                                               const Vector<uint32_t>& items) {
+  Bitset predicted(grammar.DottedCount());
+  for (uint32_t dotted : items) {
+    IndexT symbol = grammar.NextSymbol(dotted);
+    if (grammar.IsNonterminal(symbol)) {
+      predicted |= grammar.Closure(symbol);
+    }
+  }
+  Vector<uint32_t> result;
+  for (size_t dotted = predicted.find_first(); dotted != Bitset::npos;
+       dotted = predicted.find_next(dotted)) {
+    result.push_back(uint32_t(dotted));
+  }
+  return result;
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::AutomatonChart::Start() {
+  sets_.assign(1, {});
+  refs_.AddSet();
+  sets_[0].items.emplace_back(automaton_.Start(), 0);
+  uint32_t predicted = automaton_.EpsilonGoto(automaton_.Start());
+  if (predicted != Automaton::kNoState) {
+    sets_[0].items.emplace_back(predicted, 0);
+  }
+  Close(0);
+}
+
+template <typename CharT>
+bool BasicEarleyParser<CharT>::AutomatonChart::Advance(IndexT symbol) {
+  if (!grammar_.IsTerminal(symbol)) {
+    return false;
+  }
+  StateSet next_set;
+  uint32_t next_ind = uint32_t(sets_.size());
+  // scan()
+  for (Item item : sets_.back().items) {
+    uint32_t state = automaton_.Goto(item.Dotted(), symbol);
+    if (state == Automaton::kNoState) {
+      continue;
+    }
+    next_set.items.emplace_back(state, item.Origin());
+    uint32_t predicted = automaton_.EpsilonGoto(state);
+    if (predicted != Automaton::kNoState) {
+      next_set.items.emplace_back(predicted, next_ind);
+    }
+  }
+  if (next_set.items.empty()) {
+    return false;
+  }
+  // different states may go to the same one, so duplicates are removed
+  std::sort(next_set.items.begin(), next_set.items.end());
+  next_set.items.erase(
+      std::unique(next_set.items.begin(), next_set.items.end()),
+      next_set.items.end());
+  sets_.push_back(std::move(next_set));
+  refs_.AddSet();
+  Close(next_ind);
+  Retire(next_ind - 1);
+  return true;
+}
+
+template <typename CharT>
+bool BasicEarleyParser<CharT>::AutomatonChart::Accepted() const {
+  return std::ranges::any_of(sets_.back().items, [this](Item item) {
+    return item.Origin() == 0 && automaton_.Accepting(item.Dotted());
+  });
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::AutomatonChart::Close(size_t set_ind) {
+  Vector<Item>& items = sets_[set_ind].items;
+  table_.Reset(items);
+  for (size_t ind = 0; ind < items.size(); ++ind) {
+    Item item = items[ind];
+    if (item.Origin() == set_ind) {
+      continue;  // only predicted states, nullable symbols are folded in
+    }
+    for (IndexT left : automaton_.Completed(item.Dotted())) {
+      const auto& waiting = sets_[item.Origin()].waiting;
+      auto range = std::ranges::equal_range(
+          waiting, left, {}, [](const auto& pair) { return pair.first; });
+      for (const auto& [symbol, prev_item] : range) {
+        uint32_t state = automaton_.Goto(prev_item.Dotted(), symbol);
+        Add(set_ind, state, prev_item.Origin());
+        Add(set_ind, automaton_.EpsilonGoto(state), set_ind);
+      }
+    }
+  }
+  for (Item item : items) {
+    refs_.Ref(set_ind, item.Origin());
+  }
+  refs_.AddItems(items.size());
+  Seal(sets_[set_ind]);
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::AutomatonChart::Add(size_t set_ind,
+                                                   uint32_t state,
+                                                   size_t origin) {
+  if (state != Automaton::kNoState) {
+    table_.Insert(sets_[set_ind].items, Item(state, uint32_t(origin)));
+  }
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::AutomatonChart::Retire(size_t set_ind) {
+  refs_.Retire(set_ind);
+  while (auto released = refs_.PopReleased()) {
+    StateSet& set = sets_[*released];
+    for (Item item : set.items) {
+      refs_.Unref(*released, item.Origin());
+    }
+    refs_.Release(set.items.size());
+    set = StateSet();
+  }
+}
+
+template <typename CharT>
+void BasicEarleyParser<CharT>::AutomatonChart::Seal(StateSet& set) const {
+  for (Item item : set.items) {
+    for (IndexT symbol : automaton_.Waiting(item.Dotted())) {
+      set.waiting.emplace_back(symbol, item);
+    }
+  }
+  std::sort(set.waiting.begin(), set.waiting.end());
 }
 
 using WEarleyParser = BasicEarleyParser<wchar_t>;
-using EarleyParser = BasicEarleyParser<char>;
\ No newline at end of file
+using EarleyParser = BasicEarleyParser<char>;
@@ -1,8 +1,12 @@
 #pragma once
 
 #include <boost/dynamic_bitset.hpp>
+#include <cstdint>
 #include <fstream>
+#include <numeric>
+#include <queue>
 #include <stack>
+#include <variant>
 
 #include "GrammarBase.h"
 
@@ -21,14 +25,37 @@ class BasicLRParser {
 template <typename CharT>
 class BasicLRParser<CharT, 1> {
  public:
+  // layout of the parsing table: one array of all states and symbols, or
+  // rows of states overlaid in one array with default reductions
+  enum class TableKind { Dense, Compressed };
+  // states of the automaton: canonical sets of LR(1) items, LR(0) states
+  // with LALR(1) lookaheads (DeRemer, Pennello, 1982), or LR(1) states
+  // merged while they don't make conflicts (Pager, 1977); LALR and Pager fall
+  // back to canonical states if their states conflict and the grammar is
+  // LR(1), see BuiltConstruction()
+  enum class Construction { Canonical, LALR, Pager };
+
   BasicLRParser() = default;
-  BasicLRParser(const std::string& filename);
-  BasicLRParser(std::basic_istream<CharT>& input);
+  BasicLRParser(const std::string& filename,
+                TableKind kind = TableKind::Dense,
+                Construction construction = Construction::Canonical);
+  BasicLRParser(std::basic_istream<CharT>& input,
+                TableKind kind = TableKind::Dense,
+                Construction construction = Construction::Canonical);
 
+  // the kind of the table made by the next SetGrammar()
+  void SetTableKind(TableKind kind);
+  // the construction used by the next SetGrammar()
+  void SetConstruction(Construction construction);
   void SetGrammar(const std::string& filename);
   void SetGrammar(std::basic_istream<CharT>& input);
   void PrintGrammar(std::basic_ostream<CharT>& out) const;
   bool Parse(const std::basic_string<CharT>& word) const;
+  // bytes of the parsing table and of the rules
+  [[nodiscard]] size_t TableSize() const;
+  // the construction of the current table, Canonical if the chosen one fell
+  // back to canonical states
+  [[nodiscard]] Construction BuiltConstruction() const;
 
  private:
   using IndexT = GrammarBase<CharT>::IndexT;
@@ -43,11 +70,19 @@ class BasicLRParser<CharT, 1> {
   using Bitset = boost::dynamic_bitset<>;
 
   enum ActionT { Shift = 0, Reduce, Accept };
+  // kind of action packed into 32 bits: the kind is in the lower bits and
+  // the state to shift to (or to go to) or the rule to reduce by is above it
+  enum class Packed : uint32_t { Error = 0, Shift, Reduce, Accept };
   struct Action;
   struct Situation;
   struct Bucket;
+  struct RuleInfo;
   class Grammar;
   class ParseStack;
+  class DenseTable;
+  class CompressedTable;
+  class LALRBuilder;
+  class PagerBuilder;
 
   using TableT = Vector<UMap<IndexT, Action>>;
   using ActionHasher = Action::ActionHasher;
@@ -56,12 +91,31 @@ class BasicLRParser<CharT, 1> {
   using USetSits = USet<Situation, SitsHasher>;
   using USetBuckets = USet<Bucket, BucketHasher>;
 
+  static constexpr uint32_t kKindBits = 2;
+  static constexpr uint32_t kKindMask = (1 << kKindBits) - 1;
+
   Grammar grammar_;
-  TableT table_;
+  TableKind table_kind_ = TableKind::Dense;
+  Construction construction_ = Construction::Canonical;
+  Construction built_construction_ = Construction::Canonical;
+  Vector<RuleInfo> rules_;  // rules to reduce by, index is packed payload
+  std::variant<DenseTable, CompressedTable> table_;
+
+  static uint32_t Pack(Packed kind, size_t payload) {
+    return uint32_t(payload << kKindBits) | uint32_t(kind);
+  }
+  static Packed Kind(uint32_t action) { return Packed(action & kKindMask); }
+  static uint32_t Payload(uint32_t action) { return action >> kKindBits; }
 
   size_t Goto(USetBuckets& buckets, Vector<RefW<const Bucket>>& buckets_vec,
               size_t bucket_id, std::stack<Situation>& unhandled_sits);
+  template <class Table>
+  bool Parse(const Table& table, const std::basic_string<CharT>& word) const;
   void CreateTable();
+  TableT CanonicalTable();
+  TableT LALRTable();
+  TableT PagerTable();
+  void PackTable(const TableT& table);
   Bitset First(const Situation& sit) const;
   void Closure(Bucket& bucket, std::stack<Situation>& unhandled_sits);
   void Clear();
@@ -104,6 +158,14 @@ struct BasicLRParser<CharT, 1>::Action {
   }
 };
 
+// Reduce actions refer to rules by index, so the entry of the table fits in
+// 32 bits. Rules with the same length and left part are the same for parsing.
+template <typename CharT>
+struct BasicLRParser<CharT, 1>::RuleInfo {
+  uint32_t length;
+  uint32_t left;
+};
+
 template <typename CharT>
 struct BasicLRParser<CharT, 1>::Situation {
  private:
@@ -268,31 +330,671 @@ class BasicLRParser<CharT, 1>::ParseStack {
  private:
   size_t size_ = 0;
   size_t capacity_;
-  Vector<IndexT> vec_;
+  Vector<uint32_t> vec_;
 
  public:
   ParseStack(size_t capacity) : capacity_(capacity + 1), vec_(capacity_, 0) {}
-  void Push(IndexT ind) {
+  void Push(uint32_t state) {
     if (size_ == capacity_) {
       capacity_ *= 2;
       vec_.resize(capacity_);
     }
-    vec_[size_++] = ind;
+    vec_[size_++] = state;
   }
   void Pop(size_t count) { size_ -= count; }
-  IndexT Top() const { return vec_[size_ - 1]; }
+  uint32_t Top() const { return vec_[size_ - 1]; }
 };
 
+// Packed actions in one state-by-symbol array, gotos are shifts over
+// nonterminals and empty cells are errors. Row of the state is contiguous,
+// so the step of the parser reads one cell without hashing.
+template <typename CharT>
+class BasicLRParser<CharT, 1>::DenseTable {
+ public:
+  DenseTable() = default;
+  // `rows` are pairs of a symbol and a packed action, index is state
+  DenseTable(const Vector<Vector<std::pair<IndexT, uint32_t>>>& rows,
+             IndexT min_index, IndexT max_index)
+      : min_index_(min_index),
+        width_(size_t(max_index - min_index + 1)),
+        cells_(rows.size() * width_, 0) {
+    for (size_t state = 0; state < rows.size(); ++state) {
+      for (auto [symbol, action] : rows[state]) {
+        cells_[state * width_ + size_t(symbol - min_index_)] = action;
+      }
+    }
+  }
+
+  uint32_t Get(uint32_t state, IndexT symbol) const {
+    return cells_[state * width_ + size_t(symbol - min_index_)];
+  }
+  size_t Size() const { return cells_.size() * sizeof(uint32_t); }
+
+ private:
+  IndexT min_index_ = 0;
+  size_t width_ = 0;
+  Vector<uint32_t> cells_;
+};
+
+// Row displacement (comb vector): rows are put into one array at such
+// offsets that their cells don't collide, and each cell keeps the state it
+// belongs to in the check array. The most frequent reduction of the state
+// becomes its default action, which is taken on terminals without their own
+// cell, so the rows lose most of their cells. Errors are found later then,
+// but before the next shift, and the reductions can't loop, since LR(1)
+// grammars have no cycles.
+template <typename CharT>
+class BasicLRParser<CharT, 1>::CompressedTable {
+ public:
+  CompressedTable() = default;
+  CompressedTable(const Vector<Vector<std::pair<IndexT, uint32_t>>>& rows,
+                  IndexT min_index, IndexT max_index);
+
+  // a cell of another state is never chosen, so there is only a select
+  uint32_t Get(uint32_t state, IndexT symbol) const {
+    size_t ind = bases_[state] + size_t(symbol - min_index_);
+    return checks_[ind] == state ? cells_[ind] : defaults_[state];
+  }
+  size_t Size() const {
+    return (cells_.size() + checks_.size() + bases_.size() +
+            defaults_.size()) *
+           sizeof(uint32_t);
+  }
+
+ private:
+  static constexpr uint32_t kNoState = UINT32_MAX;
+
+  IndexT min_index_ = 0;
+  Vector<uint32_t> cells_;
+  Vector<uint32_t> checks_;    // state of the cell
+  Vector<uint32_t> bases_;     // index is state
+  Vector<uint32_t> defaults_;  // index is state, error if 0
+};
+
+template <typename CharT>
+BasicLRParser<CharT, 1>::CompressedTable::CompressedTable(
+    const Vector<Vector<std::pair<IndexT, uint32_t>>>& rows, IndexT min_index,
+    IndexT max_index)
+    : min_index_(min_index), bases_(rows.size(), 0), defaults_(rows.size(), 0) {
+  size_t width = size_t(max_index - min_index + 1);
+  // cells left in the rows: column and packed action
+  Vector<Vector<std::pair<size_t, uint32_t>>> left(rows.size());
+  for (size_t state = 0; state < rows.size(); ++state) {
+    UMap<uint32_t, size_t> counts;
+    for (auto [symbol, action] : rows[state]) {
+      if (symbol <= Grammar::kEpsilonInd && Kind(action) == Packed::Reduce) {
+        ++counts[action];
+      }
+    }
+    uint32_t& default_action = defaults_[state];
+    size_t max_count = 0;
+    for (auto [action, count] : counts) {
+      // ties are broken by actions, so the table doesn't depend on hashing
+      if (count > max_count ||
+          (count == max_count && action < default_action)) {
+        default_action = action;
+        max_count = count;
+      }
+    }
+    for (auto [symbol, action] : rows[state]) {
+      if (symbol > Grammar::kEpsilonInd || action != default_action) {
+        left[state].emplace_back(size_t(symbol - min_index), action);
+      }
+    }
+  }
+  // the longest rows are placed first, the first offset that fits is taken
+  Vector<size_t> order(rows.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&left](size_t lhs, size_t rhs) {
+    return left[lhs].size() > left[rhs].size();
+  });
+  size_t first_free = 0;
+  for (size_t state : order) {
+    if (left[state].empty()) {
+      continue;
+    }
+    size_t min_column = left[state][0].first;
+    for (auto [column, action] : left[state]) {
+      min_column = std::min(min_column, column);
+    }
+    size_t base = first_free > min_column ? first_free - min_column : 0;
+    auto fits = [this, &left, state](size_t base) {
+      return std::ranges::all_of(left[state], [this, base](const auto& cell) {
+        return base + cell.first >= checks_.size() ||
+               checks_[base + cell.first] == kNoState;
+      });
+    };
+    while (!fits(base)) {
+      ++base;
+    }
+    bases_[state] = uint32_t(base);
+    for (auto [column, action] : left[state]) {
+      if (base + column >= checks_.size()) {
+        checks_.resize(base + column + 1, kNoState);
+        cells_.resize(base + column + 1, 0);
+      }
+      checks_[base + column] = uint32_t(state);
+      cells_[base + column] = action;
+    }
+    while (first_free < checks_.size() && checks_[first_free] != kNoState) {
+      ++first_free;
+    }
+  }
+  // any column of any state is inside the arrays
+  size_t max_base = bases_.empty() ? 0 : *std::ranges::max_element(bases_);
+  checks_.resize(std::max(checks_.size(), max_base + width), kNoState);
+  cells_.resize(checks_.size(), 0);
+}
+
+// LALR(1) table without LR(1) items (DeRemer, Pennello, 1982). Lookaheads of
+// the reductions are found on transitions of the LR(0) automaton over
+// nonterminals: Read(p, A) are the terminals read right after the
+// transition, directly or over nullable nonterminals, and Follow(p, A) adds
+// Follow of the transitions whose rules end with A. Both are unions over
+// a relation, which are found in one pass per relation (digraph).
 template <typename CharT>
-BasicLRParser<CharT, 1>::BasicLRParser(const std::string& filename) {
+class BasicLRParser<CharT, 1>::LALRBuilder {
+ public:
+  explicit LALRBuilder(const Grammar& grammar);
+
+  // false if the table has conflicts
+  bool Build(TableT& table);
+
+ private:
+  static constexpr size_t kNoDepth = SIZE_MAX;
+
+  struct Rule {
+    IndexT left;
+    const Vector<IndexT>* right;
+    size_t length;
+  };
+
+  const Grammar& grammar_;
+  Vector<Rule> rules_;                // the rule of AUX is the first
+  UMap<IndexT, Vector<size_t>> rules_of_;
+  Vector<UMap<IndexT, size_t>> goto_;  // index is state
+  Vector<Vector<size_t>> completed_;  // rules completed in the state
+  // transitions over nonterminals: state and nonterminal
+  Vector<std::pair<size_t, IndexT>> transitions_;
+  UMap<uint64_t, size_t> transition_ids_;
+  UMap<uint64_t, Vector<size_t>> lookback_;  // (state, rule) -> transitions
+
+  static uint64_t Key(size_t state, uint64_t value) {
+    return (uint64_t(state) << 32) | value;
+  }
+  size_t Transition(size_t state, IndexT symbol) const {
+    return transition_ids_.find(Key(state, uint64_t(symbol)))->second;
+  }
+  size_t BitsetInd(IndexT symbol) const {
+    return size_t(symbol - grammar_.MinIndex());
+  }
+  void BuildStates();
+  void Digraph(const Vector<Vector<size_t>>& relation,
+               Vector<Bitset>& sets) const;
+  void Traverse(size_t node, const Vector<Vector<size_t>>& relation,
+                Vector<Bitset>& sets, Vector<size_t>& depths,
+                std::stack<size_t>& stk) const;
+};
+
+template <typename CharT>
+BasicLRParser<CharT, 1>::LALRBuilder::LALRBuilder(const Grammar& grammar)
+    : grammar_(grammar) {
+  for (IndexT left = Grammar::kAuxiliaryStartSymbolInd;
+       left <= grammar_.MaxIndex(); ++left) {
+    for (const auto& right : grammar_.RightPart(left)) {
+      size_t length =
+          right.size() - size_t(right.back() == Grammar::kEpsilonInd);
+      rules_of_[left].push_back(rules_.size());
+      rules_.push_back({left, &right, length});
+    }
+  }
+}
+
+// kernels of the states are sorted items, item is the rule and the position
+// of the dot
+template <typename CharT>
+void BasicLRParser<CharT, 1>::LALRBuilder::BuildStates() {
+  Vector<Vector<uint64_t>> kernels = {{Key(0, 0)}};
+  std::map<Vector<uint64_t>, size_t> state_ids = {{kernels[0], 0}};
+  for (size_t state = 0; state < kernels.size(); ++state) {
+    Vector<uint64_t> items = kernels[state];
+    USet<IndexT> predicted;
+    std::map<IndexT, Vector<uint64_t>> next_kernels;
+    completed_.emplace_back();
+    for (size_t ind = 0; ind < items.size(); ++ind) {
+      size_t rule = items[ind] >> 32;
+      size_t pos = items[ind] & UINT32_MAX;
+      if (pos == rules_[rule].length) {
+        completed_[state].push_back(rule);
+        continue;
+      }
+      IndexT symbol = (*rules_[rule].right)[pos];
+      next_kernels[symbol].push_back(Key(rule, pos + 1));
+      if (grammar_.IsNonterminal(symbol) && predicted.insert(symbol).second) {
+        for (size_t predicted_rule : rules_of_[symbol]) {
+          items.push_back(Key(predicted_rule, 0));
+        }
+      }
+    }
+    goto_.emplace_back();
+    for (auto& [symbol, kernel] : next_kernels) {
+      std::ranges::sort(kernel);
+      auto [iter, inserted] = state_ids.try_emplace(kernel, kernels.size());
+      if (inserted) {
+        kernels.push_back(std::move(kernel));
+      }
+      goto_[state][symbol] = iter->second;
+      if (grammar_.IsNonterminal(symbol)) {
+        transition_ids_[Key(state, uint64_t(symbol))] = transitions_.size();
+        transitions_.emplace_back(state, symbol);
+      }
+    }
+  }
+}
+
+template <typename CharT>
+bool BasicLRParser<CharT, 1>::LALRBuilder::Build(TableT& table) {
+  BuildStates();
+  size_t count = transitions_.size();
+  // Read(p, A) is DR(p, A) closed under `reads`
+  Vector<Bitset> sets(count, Bitset(grammar_.BitsetSize()));
+  Vector<Vector<size_t>> relation(count);
+  for (size_t ind = 0; ind < count; ++ind) {
+    auto [state, symbol] = transitions_[ind];
+    size_t next = goto_[state].find(symbol)->second;
+    for (auto [next_symbol, target] : goto_[next]) {
+      if (grammar_.IsTerminal(next_symbol)) {
+        sets[ind].set(BitsetInd(next_symbol));
+      } else if (grammar_.ProduceEpsilon(next_symbol)) {
+        relation[ind].push_back(Transition(next, next_symbol));
+      }
+    }
+    if (std::ranges::find(completed_[next], 0) != completed_[next].end()) {
+      sets[ind].set(BitsetInd(Grammar::kEpsilonInd));  // end of the word
+    }
+  }
+  Digraph(relation, sets);
+  // Follow(p, A) is Read(p, A) closed under `includes`: (p, A) includes
+  // (q, B) if B -> xAy, y is nullable and x leads from q to p
+  for (auto& edges : relation) {
+    edges.clear();
+  }
+  for (size_t ind = 0; ind < count; ++ind) {
+    auto [from, left] = transitions_[ind];
+    for (size_t rule : rules_of_[left]) {
+      const Vector<IndexT>& right = *rules_[rule].right;
+      size_t length = rules_[rule].length;
+      size_t nullable_from = length;
+      while (nullable_from > 0 &&
+             grammar_.ProduceEpsilon(right[nullable_from - 1])) {
+        --nullable_from;
+      }
+      size_t state = from;
+      for (size_t pos = 0; pos < length; ++pos) {
+        if (grammar_.IsNonterminal(right[pos]) && pos + 1 >= nullable_from) {
+          relation[Transition(state, right[pos])].push_back(ind);
+        }
+        state = goto_[state].find(right[pos])->second;
+      }
+      lookback_[Key(state, rule)].push_back(ind);
+    }
+  }
+  Digraph(relation, sets);
+  // shifts, reductions on lookaheads and acceptance
+  table.assign(goto_.size(), {});
+  for (size_t state = 0; state < goto_.size(); ++state) {
+    UMap<IndexT, Action>& cell = table[state];
+    for (auto [symbol, target] : goto_[state]) {
+      cell[symbol] = Action(target);
+    }
+    for (size_t rule : completed_[state]) {
+      if (rule == 0) {
+        if (!cell.insert({Grammar::kEpsilonInd, Action()}).second) {
+          std::wcerr << "reduce-reduce conflict, grammar is not LALR(1)\n";
+          return false;
+        }
+        continue;
+      }
+      Bitset lookaheads(grammar_.BitsetSize());
+      for (size_t transition : lookback_[Key(state, rule)]) {
+        lookaheads |= sets[transition];
+      }
+      Action action(rules_[rule].length, rules_[rule].left);
+      for (size_t ind = lookaheads.find_first(); ind != Bitset::npos;
+           ind = lookaheads.find_next(ind)) {
+        auto [iter, inserted] =
+            cell.insert({grammar_.FromBitsetInd(ind), action});
+        if (!inserted) {
+          std::wcerr << (iter->second.type == Shift ? "shift-reduce"
+                                                    : "reduce-reduce")
+                     << " conflict, grammar is not LALR(1)\n";
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// sets[x] becomes the union of sets[y] over y reachable from x, nodes of one
+// strongly connected component get the same set
+template <typename CharT>
+void BasicLRParser<CharT, 1>::LALRBuilder::Digraph(
+    const Vector<Vector<size_t>>& relation, Vector<Bitset>& sets) const {
+  Vector<size_t> depths(relation.size(), 0);
+  std::stack<size_t> stk;
+  for (size_t node = 0; node < relation.size(); ++node) {
+    if (depths[node] == 0) {
+      Traverse(node, relation, sets, depths, stk);
+    }
+  }
+}
+
+template <typename CharT>
+void BasicLRParser<CharT, 1>::LALRBuilder::Traverse(
+    size_t node, const Vector<Vector<size_t>>& relation, Vector<Bitset>& sets,
+    Vector<size_t>& depths, std::stack<size_t>& stk) const {
+  stk.push(node);
+  size_t depth = stk.size();
+  depths[node] = depth;
+  for (size_t next : relation[node]) {
+    if (depths[next] == 0) {
+      Traverse(next, relation, sets, depths, stk);
+    }
+    depths[node] = std::min(depths[node], depths[next]);
+    sets[node] |= sets[next];
+  }
+  if (depths[node] == depth) {
+    while (true) {
+      size_t top = stk.top();
+      stk.pop();
+      depths[top] = kNoDepth;
+      if (top == node) {
+        break;
+      }
+      sets[top] = sets[node];
+    }
+  }
+}
+
+// LR(1) states merged as they are built (Pager, 1977). States with the same
+// LR(0) kernel are merged if their lookaheads are weakly compatible: merging
+// them can't make a reduce-reduce conflict the states don't have. Grown
+// lookaheads of a merged state are passed to its successors again, which may
+// move its transitions to other states, so states no longer reachable are
+// dropped at the end.
+template <typename CharT>
+class BasicLRParser<CharT, 1>::PagerBuilder {
+ public:
+  explicit PagerBuilder(const Grammar& grammar);
+
+  // false if the table has conflicts
+  bool Build(TableT& table);
+
+ private:
+  struct Rule {
+    IndexT left;
+    const Vector<IndexT>* right;
+    size_t length;
+  };
+  // kernel of the state: sorted items and lookaheads of each item
+  struct State {
+    size_t core;
+    Vector<Bitset> lookaheads;
+  };
+
+  const Grammar& grammar_;
+  Vector<Rule> rules_;  // the rule of AUX is the first
+  UMap<IndexT, Vector<size_t>> rules_of_;
+  Vector<Vector<uint64_t>> cores_;  // items of the kernels
+  std::map<Vector<uint64_t>, size_t> core_ids_;
+  Vector<Vector<size_t>> core_states_;  // index is core
+  Vector<State> states_;
+  Vector<UMap<IndexT, size_t>> goto_;  // index is state
+  // completed rules of the state and their lookaheads
+  Vector<Vector<std::pair<size_t, Bitset>>> reductions_;
+  std::queue<size_t> queue_;
+  Vector<bool> queued_;
+
+  static uint64_t Item(size_t rule, size_t pos) {
+    return (uint64_t(rule) << 32) | pos;
+  }
+  size_t BitsetInd(IndexT symbol) const {
+    return size_t(symbol - grammar_.MinIndex());
+  }
+  void Process(size_t state);
+  size_t Merge(Vector<uint64_t>&& core, Vector<Bitset>&& lookaheads);
+  static bool WeaklyCompatible(const Vector<Bitset>& lhs,
+                               const Vector<Bitset>& rhs);
+  void Enqueue(size_t state);
+};
+
+template <typename CharT>
+BasicLRParser<CharT, 1>::PagerBuilder::PagerBuilder(const Grammar& grammar)
+    : grammar_(grammar) {
+  for (IndexT left = Grammar::kAuxiliaryStartSymbolInd;
+       left <= grammar_.MaxIndex(); ++left) {
+    for (const auto& right : grammar_.RightPart(left)) {
+      size_t length =
+          right.size() - size_t(right.back() == Grammar::kEpsilonInd);
+      rules_of_[left].push_back(rules_.size());
+      rules_.push_back({left, &right, length});
+    }
+  }
+}
+
+template <typename CharT>
+bool BasicLRParser<CharT, 1>::PagerBuilder::Build(TableT& table) {
+  Bitset end(grammar_.BitsetSize());
+  end.set(BitsetInd(Grammar::kEpsilonInd));
+  Merge({Item(0, 0)}, {end});
+  while (!queue_.empty()) {
+    size_t state = queue_.front();
+    queue_.pop();
+    queued_[state] = false;
+    Process(state);
+  }
+  // reachable states are numbered in the order of search, the start is 0
+  Vector<size_t> ids(states_.size(), SIZE_MAX);
+  Vector<size_t> order = {0};
+  ids[0] = 0;
+  for (size_t ind = 0; ind < order.size(); ++ind) {
+    for (auto [symbol, target] : goto_[order[ind]]) {
+      if (ids[target] == SIZE_MAX) {
+        ids[target] = order.size();
+        order.push_back(target);
+      }
+    }
+  }
+  table.assign(order.size(), {});
+  for (size_t id = 0; id < order.size(); ++id) {
+    size_t state = order[id];
+    UMap<IndexT, Action>& cell = table[id];
+    for (auto [symbol, target] : goto_[state]) {
+      cell[symbol] = Action(ids[target]);
+    }
+    for (const auto& [rule, lookaheads] : reductions_[state]) {
+      Action action;
+      if (rule != 0) {
+        action = Action(rules_[rule].length, rules_[rule].left);
+      }
+      for (size_t ind = lookaheads.find_first(); ind != Bitset::npos;
+           ind = lookaheads.find_next(ind)) {
+        auto [iter, inserted] =
+            cell.insert({grammar_.FromBitsetInd(ind), action});
+        if (!inserted) {
+          std::wcerr << (iter->second.type == Shift ? "shift-reduce"
+                                                    : "reduce-reduce")
+                     << " conflict of merged states\n";
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// closes the kernel of the state and merges its successors
+template <typename CharT>
+void BasicLRParser<CharT, 1>::PagerBuilder::Process(size_t state) {
+  Vector<uint64_t> items = cores_[states_[state].core];
+  Vector<Bitset> lookaheads = states_[state].lookaheads;
+  UMap<uint64_t, size_t> item_ids;
+  std::queue<size_t> unhandled;
+  for (size_t ind = 0; ind < items.size(); ++ind) {
+    item_ids[items[ind]] = ind;
+    unhandled.push(ind);
+  }
+  while (!unhandled.empty()) {
+    size_t ind = unhandled.front();
+    unhandled.pop();
+    const Rule& rule = rules_[items[ind] >> 32];
+    size_t pos = items[ind] & UINT32_MAX;
+    if (pos == rule.length || !grammar_.IsNonterminal((*rule.right)[pos])) {
+      continue;
+    }
+    // lookaheads of the predicted items: First of the rest of the rule
+    Bitset predicted(grammar_.BitsetSize());
+    size_t rest = pos + 1;
+    for (; rest < rule.length; ++rest) {
+      predicted |= grammar_.First((*rule.right)[rest]);
+      if (!grammar_.ProduceEpsilon((*rule.right)[rest])) {
+        break;
+      }
+    }
+    predicted.reset(BitsetInd(Grammar::kEpsilonInd));
+    if (rest == rule.length) {
+      predicted |= lookaheads[ind];
+    }
+    for (size_t predicted_rule : rules_of_[(*rule.right)[pos]]) {
+      auto [iter, inserted] =
+          item_ids.insert({Item(predicted_rule, 0), items.size()});
+      if (inserted) {
+        items.push_back(iter->first);
+        lookaheads.push_back(predicted);
+        unhandled.push(iter->second);
+      } else if (!predicted.is_subset_of(lookaheads[iter->second])) {
+        lookaheads[iter->second] |= predicted;
+        unhandled.push(iter->second);
+      }
+    }
+  }
+  // successors over each symbol
+  std::map<IndexT, Vector<std::pair<uint64_t, Bitset>>> next_kernels;
+  reductions_[state].clear();
+  for (size_t ind = 0; ind < items.size(); ++ind) {
+    size_t rule = items[ind] >> 32;
+    size_t pos = items[ind] & UINT32_MAX;
+    if (pos == rules_[rule].length) {
+      reductions_[state].emplace_back(rule, std::move(lookaheads[ind]));
+    } else {
+      next_kernels[(*rules_[rule].right)[pos]].emplace_back(
+          Item(rule, pos + 1), std::move(lookaheads[ind]));
+    }
+  }
+  goto_[state].clear();
+  for (auto& [symbol, kernel] : next_kernels) {
+    std::ranges::sort(kernel, {}, [](const auto& item) { return item.first; });
+    Vector<uint64_t> core;
+    Vector<Bitset> kernel_lookaheads;
+    for (auto& [item, item_lookaheads] : kernel) {
+      core.push_back(item);
+      kernel_lookaheads.push_back(std::move(item_lookaheads));
+    }
+    size_t target = Merge(std::move(core), std::move(kernel_lookaheads));
+    goto_[state][symbol] = target;
+  }
+}
+
+// returns the state the kernel is merged into
+template <typename CharT>
+size_t BasicLRParser<CharT, 1>::PagerBuilder::Merge(
+    Vector<uint64_t>&& core, Vector<Bitset>&& lookaheads) {
+  auto [iter, inserted] = core_ids_.try_emplace(std::move(core), cores_.size());
+  if (inserted) {
+    cores_.push_back(iter->first);
+    core_states_.emplace_back();
+  }
+  for (size_t state : core_states_[iter->second]) {
+    Vector<Bitset>& merged = states_[state].lookaheads;
+    if (!WeaklyCompatible(merged, lookaheads)) {
+      continue;
+    }
+    bool grown = false;
+    for (size_t ind = 0; ind < merged.size(); ++ind) {
+      if (!lookaheads[ind].is_subset_of(merged[ind])) {
+        merged[ind] |= lookaheads[ind];
+        grown = true;
+      }
+    }
+    if (grown) {
+      Enqueue(state);
+    }
+    return state;
+  }
+  core_states_[iter->second].push_back(states_.size());
+  states_.push_back({iter->second, std::move(lookaheads)});
+  goto_.emplace_back();
+  reductions_.emplace_back();
+  queued_.push_back(false);
+  Enqueue(states_.size() - 1);
+  return states_.size() - 1;
+}
+
+// for any two items lookaheads don't cross, or they already intersect in one
+// of the states
+template <typename CharT>
+bool BasicLRParser<CharT, 1>::PagerBuilder::WeaklyCompatible(
+    const Vector<Bitset>& lhs, const Vector<Bitset>& rhs) {
+  for (size_t first = 0; first < lhs.size(); ++first) {
+    for (size_t second = first + 1; second < lhs.size(); ++second) {
+      if (!lhs[first].intersects(rhs[second]) &&
+          !rhs[first].intersects(lhs[second])) {
+        continue;
+      }
+      if (!lhs[first].intersects(lhs[second]) &&
+          !rhs[first].intersects(rhs[second])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+template <typename CharT>
+void BasicLRParser<CharT, 1>::PagerBuilder::Enqueue(size_t state) {
+  if (!queued_[state]) {
+    queued_[state] = true;
+    queue_.push(state);
+  }
+}
+
+template <typename CharT>
+BasicLRParser<CharT, 1>::BasicLRParser(const std::string& filename,
+                                       TableKind kind,
+                                       Construction construction)
+    : table_kind_(kind), construction_(construction) {
   SetGrammar(filename);
 }
 
 template <typename CharT>
-BasicLRParser<CharT, 1>::BasicLRParser(std::basic_istream<CharT>& input) {
+BasicLRParser<CharT, 1>::BasicLRParser(std::basic_istream<CharT>& input,
+                                       TableKind kind,
+                                       Construction construction)
+    : table_kind_(kind), construction_(construction) {
   SetGrammar(input);
 }
 
+template <typename CharT>
+void BasicLRParser<CharT, 1>::SetTableKind(TableKind kind) {
+  table_kind_ = kind;
+}
+
+template <typename CharT>
+void BasicLRParser<CharT, 1>::SetConstruction(Construction construction) {
+  construction_ = construction;
+}
+
 template <typename CharT>
 void BasicLRParser<CharT, 1>::SetGrammar(const std::string& filename) {
   std::wifstream file(filename);
@@ -315,10 +1017,30 @@ void BasicLRParser<CharT, 1>::PrintGrammar(
 template <typename CharT>
 bool BasicLRParser<CharT, 1>::Parse(
     const std::basic_string<CharT>& word) const {
+  return std::visit([this, &word](const auto& table) {
+    return Parse(table, word);
+  }, table_);
+}
+
+template <typename CharT>
+size_t BasicLRParser<CharT, 1>::TableSize() const {
+  return std::visit([](const auto& table) { return table.Size(); }, table_) +
+         rules_.size() * sizeof(RuleInfo);
+}
+
+template <typename CharT>
+BasicLRParser<CharT, 1>::Construction
+BasicLRParser<CharT, 1>::BuiltConstruction() const {
+  return built_construction_;
+}
+
+template <typename CharT>
+template <class Table>
+bool BasicLRParser<CharT, 1>::Parse(
+    const Table& table, const std::basic_string<CharT>& word) const {
   ParseStack stack(word.size());
   stack.Push(0);
   size_t curr_pos = 0;
-  IndexT left;  // index of left nonterminal in rule for reduce
   IndexT curr_ind;
   while (true) {
     if (curr_pos < word.size()) {
@@ -329,27 +1051,26 @@ bool BasicLRParser<CharT, 1>::Parse(
     } else {
       curr_ind = Grammar::kEpsilonInd;
     }
-    auto iter = table_[stack.Top()].find(curr_ind);
-    if (iter == table_[stack.Top()].end()) {
-      return false;
-    }
-    const Action& act = iter->second;
-    switch (act.type) {
-      case Shift:
-        stack.Push(act.id);
+    uint32_t act = table.Get(stack.Top(), curr_ind);
+    switch (Kind(act)) {
+      case Packed::Shift:
+        stack.Push(Payload(act));
         ++curr_pos;
         break;
-      case Reduce:
-        stack.Pop(act.length);
-        left = act.left;
-        iter = table_[stack.Top()].find(left);
-        if (iter == table_[stack.Top()].end()) {
+      case Packed::Reduce: {
+        const RuleInfo& rule = rules_[Payload(act)];
+        stack.Pop(rule.length);
+        act = table.Get(stack.Top(), IndexT(rule.left));
+        if (Kind(act) != Packed::Shift) {
           return false;
         }
-        stack.Push(iter->second.id);
+        stack.Push(Payload(act));
         break;
-      case Accept:
+      }
+      case Packed::Accept:
         return true;
+      case Packed::Error:
+        return false;
     }
   }
 }
@@ -371,6 +1092,23 @@ size_t BasicLRParser<CharT, 1>::Goto(USetBuckets& buckets,
 
 template <typename CharT>
 void BasicLRParser<CharT, 1>::CreateTable() {
+  built_construction_ = construction_;
+  switch (construction_) {
+    case Construction::Canonical:
+      PackTable(CanonicalTable());
+      break;
+    case Construction::LALR:
+      PackTable(LALRTable());
+      break;
+    case Construction::Pager:
+      PackTable(PagerTable());
+      break;
+  }
+}
+
+template <typename CharT>
+BasicLRParser<CharT, 1>::TableT BasicLRParser<CharT, 1>::CanonicalTable() {
+  TableT table;
   USetBuckets buckets;
   Vector<RefW<const Bucket>> buckets_vec;
   std::stack<Situation> unhandled_sits;  // for closure
@@ -412,9 +1150,72 @@ void BasicLRParser<CharT, 1>::CreateTable() {
         // todo: make exception
       }
     }
-    table_.push_back(table_cell);
+    table.push_back(table_cell);
     ++curr;
   }
+  return table;
+}
+
+template <typename CharT>
+BasicLRParser<CharT, 1>::TableT BasicLRParser<CharT, 1>::LALRTable() {
+  TableT table;
+  if (!LALRBuilder(grammar_).Build(table)) {
+    // merged lookaheads may be the only reason of the conflict, the canonical
+    // table has it only if the grammar is not LR(1)
+    std::wcerr << "canonical states are used instead of LALR(1) ones\n";
+    built_construction_ = Construction::Canonical;
+    return CanonicalTable();
+  }
+  return table;
+}
+
+template <typename CharT>
+BasicLRParser<CharT, 1>::TableT BasicLRParser<CharT, 1>::PagerTable() {
+  TableT table;
+  if (!PagerBuilder(grammar_).Build(table)) {
+    // lookaheads left from the moved transitions may make a conflict, the
+    // canonical table has it only if the grammar is not LR(1)
+    std::wcerr << "canonical states are used instead of merged ones\n";
+    built_construction_ = Construction::Canonical;
+    return CanonicalTable();
+  }
+  return table;
+}
+
+template <typename CharT>
+void BasicLRParser<CharT, 1>::PackTable(const TableT& table) {
+  assert(("Too many states to pack", table.size() < (1 << (32 - kKindBits))));
+  UMap<uint64_t, uint32_t> rule_ids;  // (length, left) -> index in rules_
+  Vector<Vector<std::pair<IndexT, uint32_t>>> rows(table.size());
+  for (size_t state = 0; state < table.size(); ++state) {
+    for (const auto& [symbol, act] : table[state]) {
+      uint32_t packed = 0;
+      switch (act.type) {
+        case Shift:
+          packed = Pack(Packed::Shift, act.id);
+          break;
+        case Reduce: {
+          uint64_t key = (uint64_t(act.length) << 32) | uint64_t(act.left);
+          auto [iter, inserted] =
+              rule_ids.insert({key, uint32_t(rules_.size())});
+          if (inserted) {
+            rules_.push_back({uint32_t(act.length), uint32_t(act.left)});
+          }
+          packed = Pack(Packed::Reduce, iter->second);
+          break;
+        }
+        case Accept:
+          packed = Pack(Packed::Accept, 0);
+          break;
+      }
+      rows[state].emplace_back(symbol, packed);
+    }
+  }
+  if (table_kind_ == TableKind::Compressed) {
+    table_ = CompressedTable(rows, grammar_.MinIndex(), grammar_.MaxIndex());
+  } else {
+    table_ = DenseTable(rows, grammar_.MinIndex(), grammar_.MaxIndex());
+  }
 }
 
 template <typename CharT>
@@ -486,7 +1287,8 @@ void BasicLRParser<CharT, 1>::Closure(Bucket& bucket,
 template <typename CharT>
 void BasicLRParser<CharT, 1>::Clear() {
   grammar_.Clear();
-  table_.clear();
+  rules_.clear();
+  table_ = DenseTable();
 }
 
 template <size_t K>
@@ -5,8 +5,12 @@
 #include <cstddef>
 #include <iostream>
 #include <limits>
+#include <map>
+#include <sstream>
 #include <stack>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -41,9 +45,15 @@ class GrammarBase {
   void Read(std::basic_istream<CharT>& input);
   virtual void Print(std::basic_ostream<CharT>& out) const;
 
+  // class of the terminal for terminals
   IndexT ToInd(CharT symbol) const;
+  // terminal itself, its class is ClassOf()
+  IndexT TerminalInd(CharT symbol) const;
+  IndexT ClassOf(IndexT terminal) const;
+  const String& ToStr(IndexT symbol) const;
   IndexT NonterminalsCount() const;
-  IndexT TerminalsCount() const;
+  IndexT TerminalsCount() const;  // classes of terminals
+  IndexT SourceTerminalsCount() const;
   bool IsTerminal(IndexT symbol) const;
   bool IsNonterminal(IndexT symbol) const;
   bool IncorrectInput(IndexT ind) const;
@@ -52,24 +62,41 @@ class GrammarBase {
 
  protected:
   static const String kAuxiliaryStr;
-  static constexpr CharT kSlash = L'\\';
-  static constexpr std::basic_string_view<CharT> kSlashStr = L"\\";
-  static constexpr std::basic_string_view<CharT> kSlashEscape = L"\\\\";
-  static constexpr CharT kDelim = L'`';
+  static constexpr CharT kSlash = '\\';
+  static const String kSlashStr;
+  static const String kSlashEscape;
+  static constexpr CharT kDelim = '`';
   static const String kDelimSpecial;
   static const String kRulesDelim;
-  static constexpr CharT kRulesDelimSymbol = L'|';
-  static constexpr std::basic_string_view<CharT> kRulesDelimEscape = L"\\|";
-  static constexpr std::basic_string_view<CharT> kArrowStr = L" -> ";
+  static constexpr CharT kRulesDelimSymbol = '|';
+  static const String kRulesDelimEscape;
+  static const String kArrowStr;
+  static constexpr size_t kDirectSymbols = 256;
 
   // terminals are <= -1, nonterminals >= 1
   // epsilon is 0, auxiliary start symbol is 1, start symbol is 2
   UMap<IndexT, String> map_ind_str_;
   UMap<String, IndexT> map_str_ind_;
-  IndexT terminals_count_;     // except for epsilon
+  UMap<CharT, IndexT> map_symbol_ind_;  // one-character symbols of map_str_ind_
+  Vector<IndexT> direct_symbol_ind_;    // ToInd() of the first kDirectSymbols
+  IndexT terminals_count_;     // classes of terminals, except for epsilon
   IndexT nonterminals_count_;  // except for auxiliary start symbol
-  RulesT rules_;
-
+  RulesT rules_;               // over classes of terminals
+  // the grammar as it is read: terminal standing for the class `-c` is `-c`,
+  // the rest of terminals are after the classes
+  IndexT source_terminals_count_;
+  Vector<IndexT> source_terminals_;  // in the order of reading
+  Vector<IndexT> terminal_class_;    // index is -terminal - 1
+  RulesT source_rules_;
+  // alternative of rules_ made of each alternative of source_rules_
+  UMap<IndexT, Vector<size_t>> source_rule_class_;
+
+  // names and delimiters are ASCII, messages go to std::wcerr
+  static String FromAscii(std::string_view str);
+  static std::wstring ToWide(const String& str);
+
+  void CreateTerminalClasses();
+  void CreateSymbolMap();
   virtual void AfterRead() = 0;
   virtual void AfterClear() = 0;
 
@@ -102,17 +129,66 @@ class GrammarBase {
 
 template <typename CharT>
 const GrammarBase<CharT>::String GrammarBase<CharT>::kAuxiliaryStr =
-    L"AUXILIARY";
+    FromAscii("AUXILIARY");
+template <typename CharT>
+const GrammarBase<CharT>::String GrammarBase<CharT>::kSlashStr =
+    FromAscii("\\");
+template <typename CharT>
+const GrammarBase<CharT>::String GrammarBase<CharT>::kSlashEscape =
+    FromAscii("\\\\");
+template <typename CharT>
+const GrammarBase<CharT>::String GrammarBase<CharT>::kDelimSpecial;
 template <typename CharT>
-const GrammarBase<CharT>::String GrammarBase<CharT>::kDelimSpecial = L"";
+const GrammarBase<CharT>::String GrammarBase<CharT>::kRulesDelim =
+    FromAscii(" | ");
 template <typename CharT>
-const GrammarBase<CharT>::String GrammarBase<CharT>::kRulesDelim = L" | ";
+const GrammarBase<CharT>::String GrammarBase<CharT>::kRulesDelimEscape =
+    FromAscii("\\|");
+template <typename CharT>
+const GrammarBase<CharT>::String GrammarBase<CharT>::kArrowStr =
+    FromAscii(" -> ");
+
+template <typename CharT>
+GrammarBase<CharT>::String GrammarBase<CharT>::FromAscii(
+    std::string_view str) {
+  return String(str.begin(), str.end());
+}
+
+template <typename CharT>
+std::wstring GrammarBase<CharT>::ToWide(const String& str) {
+  std::wstring res(str.size(), L'\0');
+  std::ranges::transform(str, res.begin(), [](CharT symbol) {
+    return wchar_t(static_cast<std::make_unsigned_t<CharT>>(symbol));
+  });
+  return res;
+}
 
 template <typename CharT>
 GrammarBase<CharT>::IndexT GrammarBase<CharT>::ToInd(CharT symbol) const {
-  auto itr = map_str_ind_.find(String(1, symbol));
-  return (itr == map_str_ind_.end()) ? kIncorrectSymbolInd : itr->second;
+  auto code = static_cast<std::make_unsigned_t<CharT>>(symbol);
+  if (code < direct_symbol_ind_.size()) {
+    return direct_symbol_ind_[code];
+  }
+  IndexT ind = TerminalInd(symbol);
+  return IsTerminal(ind) ? ClassOf(ind) : ind;
 }
+
+template <typename CharT>
+GrammarBase<CharT>::IndexT GrammarBase<CharT>::TerminalInd(CharT symbol) const {
+  auto itr = map_symbol_ind_.find(symbol);
+  return (itr == map_symbol_ind_.end()) ? kIncorrectSymbolInd : itr->second;
+}
+
+template <typename CharT>
+GrammarBase<CharT>::IndexT GrammarBase<CharT>::ClassOf(IndexT terminal) const {
+  return terminal_class_[-terminal - 1];
+}
+template <typename CharT>
+const GrammarBase<CharT>::String& GrammarBase<CharT>::ToStr(
+    IndexT symbol) const {
+  return map_ind_str_.find(symbol)->second;
+}
+
 template <typename CharT>
 GrammarBase<CharT>::IndexT GrammarBase<CharT>::NonterminalsCount() const {
   return nonterminals_count_;
@@ -123,6 +199,11 @@ GrammarBase<CharT>::IndexT GrammarBase<CharT>::TerminalsCount() const {
   return terminals_count_;
 }
 
+template <typename CharT>
+GrammarBase<CharT>::IndexT GrammarBase<CharT>::SourceTerminalsCount() const {
+  return source_terminals_count_;
+}
+
 template <typename CharT>
 bool GrammarBase<CharT>::IsTerminal(IndexT symbol) const {
   return symbol < 0;
@@ -147,8 +228,14 @@ template <typename CharT>
 void GrammarBase<CharT>::Clear() {
   map_ind_str_.clear();
   map_str_ind_.clear();
-  nonterminals_count_ = terminals_count_ = 0;
+  map_symbol_ind_.clear();
+  direct_symbol_ind_.clear();
+  nonterminals_count_ = terminals_count_ = source_terminals_count_ = 0;
   rules_.clear();
+  source_terminals_.clear();
+  terminal_class_.clear();
+  source_rules_.clear();
+  source_rule_class_.clear();
 }
 
 template <typename CharT>
@@ -166,9 +253,9 @@ void GrammarBase<CharT>::Print(std::basic_ostream<CharT>& out) const {
   }
   out << map_ind_str_.find(nonterminals_count_ + 1)->second << '\n';
   // terminals
-  for (IndexT i = 1; i <= terminals_count_; ++i) {
-    CharT end = (i == terminals_count_) ? '\n' : kDelim;
-    String symbol = map_ind_str_.find(-i)->second;
+  for (size_t i = 0; i < source_terminals_.size(); ++i) {
+    CharT end = (i + 1 == source_terminals_.size()) ? '\n' : kDelim;
+    String symbol = map_ind_str_.find(source_terminals_[i])->second;
     if (symbol == String(1, kDelim)) {
       out << kSlash << kDelim << end;
     } else if (symbol == kSlashStr) {
@@ -186,7 +273,7 @@ template <typename CharT>
 void GrammarBase<CharT>::PrintRules(std::basic_ostream<CharT>& out) const {
   for (IndexT i = 2; i <= nonterminals_count_ + 1; ++i) {
     out << map_ind_str_.find(i)->second << kArrowStr;
-    RulesRightT right_parts = rules_.find(i)->second;
+    RulesRightT right_parts = source_rules_.find(i)->second;
     bool prev_was_nonterminal;
     auto pred = [&prev_was_nonterminal, this](IndexT ind, size_t s_i) -> bool {
       return (IsNonterminal(ind) && s_i != 0) ||
@@ -204,9 +291,9 @@ void GrammarBase<CharT>::PrintRules(std::basic_ostream<CharT>& out) const {
       prev_was_nonterminal = false;
       for (size_t s_i = 0; s_i < right_parts[r_i].size(); ++s_i) {
         auto iter_ind_str = map_ind_str_.find(right_parts[r_i][s_i]);
-        String delim = pred(iter_ind_str->first, s_i) ? String(1, kDelim) : L"";
+        String delim = pred(iter_ind_str->first, s_i) ? String(1, kDelim) : String();
         if (iter_ind_str->second == String(1, kDelim)) {
-          String end = end_pred(r_i, s_i) ? String(1, kDelim) : L"";
+          String end = end_pred(r_i, s_i) ? String(1, kDelim) : String();
           out << kDelim << kSlash << kDelim << end;
           prev_was_nonterminal = true;
           continue;  // to avoid changing `prev_was_nonterminal`
@@ -234,9 +321,105 @@ void GrammarBase<CharT>::Read(std::basic_istream<CharT>& input) {
   ReadSymbols(input);
   rules_.insert({kAuxiliaryStartSymbolInd, {{kStartSymbolInd}}});
   ReadRules(input);
+  CreateTerminalClasses();
+  CreateSymbolMap();
   AfterRead();
 }
 
+// Terminals having the same contexts in the rules (rule with a hole in place
+// of an occurrence of the terminal) are interchangeable: replacing one of them
+// with another in a rule gives a rule too, so the language and derivations
+// keep such replacements. Rules are made over the classes, which shrinks
+// tables and sets indexed by terminals.
+template <typename CharT>
+void GrammarBase<CharT>::CreateTerminalClasses() {
+  using Context = std::pair<IndexT, Vector<IndexT>>;
+  Vector<Vector<Context>> contexts(terminals_count_);
+  for (const auto& [left, right_parts] : rules_) {
+    for (const auto& right : right_parts) {
+      for (size_t pos = 0; pos < right.size(); ++pos) {
+        if (IsTerminal(right[pos])) {
+          Context context(left, right);
+          context.second[pos] = kIncorrectSymbolInd;
+          contexts[-right[pos] - 1].push_back(std::move(context));
+        }
+      }
+    }
+  }
+  // classes are numbered in the order of their first terminals
+  std::map<Vector<Context>, IndexT> classes;
+  Vector<IndexT> classes_of(terminals_count_);
+  for (IndexT ind = 0; ind < terminals_count_; ++ind) {
+    Vector<Context>& signature = contexts[ind];
+    std::ranges::sort(signature);
+    signature.erase(std::unique(signature.begin(), signature.end()),
+                    signature.end());
+    classes_of[ind] =
+        classes.try_emplace(std::move(signature), IndexT(classes.size()))
+            .first->second;
+  }
+  auto classes_count = IndexT(classes.size());
+  // first terminal of the class `c` becomes `-c - 1`
+  Vector<IndexT> new_ind(terminals_count_);
+  Vector<bool> numbered(classes_count, false);
+  for (IndexT ind = 0, next = classes_count; ind < terminals_count_; ++ind) {
+    IndexT cls = classes_of[ind];
+    new_ind[ind] = numbered[cls] ? -++next : -cls - 1;
+    numbered[cls] = true;
+  }
+  auto renumber = [&new_ind, this](IndexT symbol) {
+    return IsTerminal(symbol) ? new_ind[-symbol - 1] : symbol;
+  };
+  UMap<IndexT, String> map_ind_str;
+  for (auto& [ind, str] : map_ind_str_) {
+    map_ind_str.insert({renumber(ind), std::move(str)});
+  }
+  map_ind_str_ = std::move(map_ind_str);
+  for (auto& [str, ind] : map_str_ind_) {
+    ind = renumber(ind);
+  }
+  source_terminals_ = new_ind;
+  terminal_class_.assign(terminals_count_, 0);
+  for (IndexT ind = 0; ind < terminals_count_; ++ind) {
+    terminal_class_[-new_ind[ind] - 1] = -classes_of[ind] - 1;
+  }
+  source_rules_ = std::move(rules_);
+  rules_.clear();
+  for (auto& [left, right_parts] : source_rules_) {
+    RulesRightT& class_parts = rules_[left];
+    Vector<size_t>& class_of_part = source_rule_class_[left];
+    std::map<Vector<IndexT>, size_t> added;
+    for (auto& right : right_parts) {
+      std::ranges::transform(right, right.begin(), renumber);
+      Vector<IndexT> class_right = right;
+      for (IndexT& symbol : class_right) {
+        symbol = IsTerminal(symbol) ? ClassOf(symbol) : symbol;
+      }
+      auto [itr, inserted] = added.try_emplace(class_right, class_parts.size());
+      if (inserted) {
+        class_parts.push_back(std::move(class_right));
+      }
+      class_of_part.push_back(itr->second);
+    }
+  }
+  source_terminals_count_ = terminals_count_;
+  terminals_count_ = classes_count;
+}
+
+template <typename CharT>
+void GrammarBase<CharT>::CreateSymbolMap() {
+  direct_symbol_ind_.assign(kDirectSymbols, kIncorrectSymbolInd);
+  for (const auto& [str, ind] : map_str_ind_) {
+    if (str.size() == 1) {
+      map_symbol_ind_.insert({str[0], ind});
+      auto code = static_cast<std::make_unsigned_t<CharT>>(str[0]);
+      if (code < kDirectSymbols) {
+        direct_symbol_ind_[code] = IsTerminal(ind) ? ClassOf(ind) : ind;
+      }
+    }
+  }
+}
+
 template <typename CharT>
 void GrammarBase<CharT>::ReadFirstLine(std::basic_istream<CharT>& input) {
   String line;
@@ -255,7 +438,7 @@ template <typename CharT>
 void GrammarBase<CharT>::ReadSymbols(std::basic_istream<CharT>& input) {
   // nonterminals
   String line;
-  std::getline(input, line, L'\n');
+  std::getline<CharT>(input, line, '\n');
   Vector<String> split_res = utl::Split(line, String(1, kDelim));
   if (split_res.size() == 1 && split_res[0].empty()) {
     // case when S is the only nonterminal
@@ -268,7 +451,7 @@ void GrammarBase<CharT>::ReadSymbols(std::basic_istream<CharT>& input) {
     map_ind_str_.insert({i + 3, split_res[i]});
   }
   // terminals
-  std::getline(input, line, L'\n');
+  std::getline<CharT>(input, line, '\n');
   split_res = utl::Split(line, String(1, kDelim));
   terminals_count_ = static_cast<IndexT>(split_res.size());
   for (IndexT i = 0, j = 0; i < split_res.size(); ++i, ++j) {
@@ -320,8 +503,8 @@ void GrammarBase<CharT>::ReadRules(std::basic_istream<CharT>& input) {
   // todo: add case bad reading
   for (size_t i = 0; i < nonterminals_count_; ++i) {
     IndexT left = ReadLeftNonterminal(input);
-    std::getline(input, line, L' ');   // reading ->
-    std::getline(input, line, L'\n');  // reading all right parts
+    std::getline<CharT>(input, line, ' ');   // reading ->
+    std::getline<CharT>(input, line, '\n');  // reading all right parts
     split_res = utl::Split(line, kRulesDelim);
     for (const auto& right_part : split_res) {
       ReadRightPart(left, right_part);
@@ -333,20 +516,20 @@ template <typename CharT>
 typename GrammarBase<CharT>::IndexT GrammarBase<CharT>::ReadLeftNonterminal(
     std::basic_istream<CharT>& input) {
   String line;
-  std::getline(input, line, L' ');  // reading left nonterminal
+  std::getline<CharT>(input, line, ' ');  // reading left nonterminal
   auto iter_symbol_to_num = map_str_ind_.find(line);
   if (iter_symbol_to_num == map_str_ind_.end() ||
       iter_symbol_to_num->second <= 0) {
     if (ContainArrow({line})) {
-      line = line.substr(0, line.find(L'\n'));
-      std::wcerr << L"No spaces around the arrow: " << line;
+      line = line.substr(0, line.find('\n'));
+      std::wcerr << L"No spaces around the arrow: " << ToWide(line);
       exit(ExitStatus::IncorrectGrammarInput);
     } else if (line.empty()) {
       std::wcerr
           << L"No left nonterminal in rule or extra nonterminals listed\n";
       exit(ExitStatus::IncorrectGrammarInput);
     }
-    std::wcerr << L"Incorrect left nonterminal `" << line << L"` in rule";
+    std::wcerr << L"Incorrect left nonterminal `" << ToWide(line) << L"` in rule";
     std::wcerr << L" (maybe double spaces)\n";
     exit(ExitStatus::IncorrectGrammarInput);
   }
@@ -357,7 +540,7 @@ template <typename CharT>
 void GrammarBase<CharT>::ReadRightPart(IndexT left, const String& right_part) {
   if (right_part.empty()) {
     std::wcerr << L"Incorrect right part of the rule with left nonterminal ";
-    std::wcerr << L'`' << map_ind_str_[left] << L"`\n";
+    std::wcerr << L'`' << ToWide(map_ind_str_[left]) << L"`\n";
     exit(ExitStatus::IncorrectGrammarInput);
   }
   if (right_part == map_ind_str_[kEpsilonInd]) {
@@ -442,7 +625,7 @@ void GrammarBase<CharT>::ReadEscapeSymbol(IndexT start_ind, size_t& err_offt,
   auto iter_str_ind = map_str_ind_.find(String(1, symbol));
   if (iter_str_ind == map_str_ind_.end()) {
     ReadRightPartPrintError(start_ind, err_offt, symbols);
-    std::wcerr << symbol << " is not a terminal\n";
+    std::wcerr << wchar_t(symbol) << " is not a terminal\n";
     exit(ExitStatus::IncorrectGrammarInput);
   }
   right.push_back(iter_str_ind->second);
@@ -454,13 +637,15 @@ void GrammarBase<CharT>::ReadRightPartPrintError(
     IndexT start_ind, size_t offset_for_error, const Vector<String>& symbols) {
   if (ContainArrow(symbols)) {
     std::wcerr << L"Incorrect number of spaces between "
-               << map_ind_str_[start_ind] << L" and rules_\n";
+               << ToWide(map_ind_str_[start_ind]) << L" and rules_\n";
     exit(ExitStatus::IncorrectGrammarInput);
   }
   std::wcerr << L"Incorrect nonterminal, extra space or missing '`' "
              << L"in right part of the rule:\n";
-  std::wcerr << map_ind_str_[start_ind] << L" -> ";
-  PrintRightPartOfRule(std::wcerr, symbols);
+  std::basic_ostringstream<CharT> right_part;
+  PrintRightPartOfRule(right_part, symbols);
+  std::wcerr << ToWide(map_ind_str_[start_ind]) << L" -> "
+             << ToWide(right_part.str());
   std::wcerr << L'\n';
   for (size_t i = 0; i < offset_for_error; ++i) {
     std::wcerr << L' ';
@@ -470,7 +655,7 @@ void GrammarBase<CharT>::ReadRightPartPrintError(
 
 template <typename CharT>
 bool GrammarBase<CharT>::ContainArrow(const Vector<String>& symbols) const {
-  return !symbols.empty() && symbols[0].find(L"->") != symbols[0].npos;
+  return !symbols.empty() && symbols[0].find(FromAscii("->")) != symbols[0].npos;
 }
 
 template <typename CharT>
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <span>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// Append-only temporary file of records which are mapped back to memory
+
+namespace utl {
+// Records are gathered in a buffer of `chunk_bytes` and written by whole
+// chunks, each chunk is mapped read-only once it is written. So records are
+// stored as they are and read in place, and pages of old records are dropped
+// by the kernel under memory pressure and read again on access. The file is
+// removed as soon as it is created, so it goes away with the process.
+template <typename T>
+class SpillFile {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+ public:
+  explicit SpillFile(size_t chunk_bytes = size_t(1) << 22)
+      : chunk_size_(std::max<size_t>(chunk_bytes / sizeof(T), 1)) {
+    const char* dir = std::getenv("TMPDIR");
+    std::string path = std::string(dir != nullptr ? dir : "/tmp") +
+                       "/spill-XXXXXX";
+    fd_ = mkstemp(path.data());
+    if (fd_ == -1) {
+      throw std::system_error(errno, std::generic_category(), path);
+    }
+    unlink(path.c_str());
+    buffer_.reserve(chunk_size_);
+  }
+  SpillFile(const SpillFile&) = delete;
+  SpillFile& operator=(const SpillFile&) = delete;
+  ~SpillFile() {
+    for (auto [data, bytes] : chunks_) {
+      munmap(data, bytes);
+    }
+    close(fd_);
+  }
+
+  // returns the number of the record
+  size_t Append(std::span<const T> values) {
+    // spans of buffered records stay valid until the buffer is written
+    if (!buffer_.empty() && buffer_.size() + values.size() > chunk_size_) {
+      Flush();
+    }
+    records_.push_back({chunks_.size(), buffer_.size(), values.size()});
+    buffer_.insert(buffer_.end(), values.begin(), values.end());
+    if (buffer_.size() >= chunk_size_) {
+      Flush();
+    }
+    return records_.size() - 1;
+  }
+
+  // valid until the next Append()
+  [[nodiscard]] std::span<const T> Get(size_t record) const {
+    const Record& rec = records_[record];
+    const T* data = rec.chunk == chunks_.size()
+                        ? buffer_.data()
+                        : static_cast<const T*>(chunks_[rec.chunk].first);
+    return {data + rec.offset, rec.size};
+  }
+
+  // bytes written to the file
+  [[nodiscard]] size_t Bytes() const { return file_size_; }
+
+ private:
+  struct Record {
+    size_t chunk;
+    size_t offset;  // in values
+    size_t size;
+  };
+
+  int fd_ = -1;
+  size_t chunk_size_;  // in values
+  std::vector<T> buffer_;
+  std::vector<std::pair<void*, size_t>> chunks_;  // mappings and their bytes
+  std::vector<Record> records_;
+  size_t file_size_ = 0;
+
+  // chunks start at page boundaries, since mappings must
+  void Flush() {
+    size_t bytes = buffer_.size() * sizeof(T);
+    const char* data = reinterpret_cast<const char*>(buffer_.data());
+    for (size_t written = 0; written < bytes;) {
+      ssize_t res = pwrite(fd_, data + written, bytes - written,
+                           off_t(file_size_ + written));
+      if (res == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::system_error(errno, std::generic_category(), "pwrite");
+      }
+      written += size_t(res);
+    }
+    void* mapped =
+        mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd_, off_t(file_size_));
+    if (mapped == MAP_FAILED) {
+      throw std::system_error(errno, std::generic_category(), "mmap");
+    }
+    chunks_.emplace_back(mapped, bytes);
+    size_t page = size_t(sysconf(_SC_PAGESIZE));
+    file_size_ += (bytes + page - 1) / page * page;
+    buffer_.clear();
+  }
+};
+}  // namespace utl
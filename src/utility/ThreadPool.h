@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Pool of threads running parallel loops with work stealing. The work of a
+/// loop is a range of indices, so the deque of each thread is a range too:
+/// the thread takes chunks from the front of its part, and a thread that has
+/// run out of work steals the back half of the part of another one.
+
+namespace utl {
+class ThreadPool {
+ public:
+  using Body = std::function<void(size_t begin, size_t end, size_t worker)>;
+
+  // `threads` counts the thread calling ParallelFor() too
+  explicit ThreadPool(size_t threads)
+      : parts_(std::make_unique<Part[]>(std::max<size_t>(threads, 1))) {
+    for (size_t worker = 1; worker < threads; ++worker) {
+      workers_.emplace_back([this, worker]() { Work(worker); });
+    }
+  }
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(mutex_);
+      stop_ = true;
+    }
+    start_cv_.notify_all();
+    for (auto& thread : workers_) {
+      thread.join();
+    }
+  }
+
+  [[nodiscard]] size_t Size() const { return workers_.size() + 1; }
+
+  // calls `body` for chunks of [0, count), each thread starts with an equal
+  // part of the range; returns when all chunks are done
+  void ParallelFor(size_t count, size_t chunk, const Body& body) {
+    assert(("Too many indices for the pool", count <= UINT32_MAX));
+    {
+      std::lock_guard lock(mutex_);
+      body_ = &body;
+      chunk_ = std::max<size_t>(chunk, 1);
+      for (size_t worker = 0; worker < Size(); ++worker) {
+        parts_[worker].bounds = Pack(count * worker / Size(),
+                                     count * (worker + 1) / Size());
+      }
+      busy_ = workers_.size();
+      ++round_;
+    }
+    start_cv_.notify_all();
+    RunChunks(0);
+    std::unique_lock lock(mutex_);
+    done_cv_.wait(lock, [this]() { return busy_ == 0; });
+  }
+
+ private:
+  // [begin, end) of the indices left to the worker, packed into 64 bits so
+  // the owner and thieves change it with one compare-and-swap
+  struct alignas(64) Part {
+    std::atomic<uint64_t> bounds = 0;
+  };
+
+  std::unique_ptr<Part[]> parts_;  // index is worker
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  const Body* body_ = nullptr;
+  size_t chunk_ = 1;
+  size_t round_ = 0;  // number of the current loop
+  size_t busy_ = 0;   // workers that have not finished the current loop
+  bool stop_ = false;
+
+  void Work(size_t worker) {
+    size_t round = 0;
+    while (true) {
+      {
+        std::unique_lock lock(mutex_);
+        start_cv_.wait(lock, [this, round]() {
+          return stop_ || round_ != round;
+        });
+        if (stop_) {
+          return;
+        }
+        round = round_;
+      }
+      RunChunks(worker);
+      std::lock_guard lock(mutex_);
+      if (--busy_ == 0) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+
+  static uint64_t Pack(size_t begin, size_t end) {
+    return (uint64_t(begin) << 32) | end;
+  }
+  static size_t Begin(uint64_t bounds) { return bounds >> 32; }
+  static size_t End(uint64_t bounds) { return uint32_t(bounds); }
+
+  void RunChunks(size_t worker) {
+    std::atomic<uint64_t>& own = parts_[worker].bounds;
+    while (true) {
+      uint64_t bounds = own.load();
+      size_t begin = Begin(bounds);
+      size_t end = std::min(begin + chunk_, End(bounds));
+      if (begin >= end) {
+        if (!Steal(worker)) {
+          return;
+        }
+        continue;
+      }
+      if (own.compare_exchange_weak(bounds, Pack(end, End(bounds)))) {
+        (*body_)(begin, end, worker);
+      }
+    }
+  }
+
+  // moves the back half of the part of another worker to the empty part of
+  // the worker, returns 'false' if all of the parts are empty; the stolen
+  // indices are in no part for a moment, but the thief runs them anyway
+  bool Steal(size_t worker) {
+    for (size_t shift = 1; shift < Size(); ++shift) {
+      std::atomic<uint64_t>& victim = parts_[(worker + shift) % Size()].bounds;
+      uint64_t bounds = victim.load();
+      while (Begin(bounds) < End(bounds)) {
+        size_t middle = Begin(bounds) + (End(bounds) - Begin(bounds)) / 2;
+        if (victim.compare_exchange_weak(bounds,
+                                         Pack(Begin(bounds), middle))) {
+          parts_[worker].bounds = Pack(middle, End(bounds));
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+};
+}  // namespace utl